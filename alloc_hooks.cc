@@ -0,0 +1,100 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+* Replaces the global operator new/delete with versions which count every
+* allocation for AllocationScope. Linked in by the alloc_hooks library,
+* i.e. only when building with --define alloc_tracking=1.
+*/
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "alloc_tracker.h"
+
+
+/* ############################################################################ */
+/* ############################ HELPER FUNCTIONS ############################## */
+/* ############################################################################ */
+
+namespace {
+
+/*
+* Allocates like the default operator new, counting the allocation.
+*
+* @return pointer - The allocated memory, or nullptr if out of memory and no new handler is set
+*/
+void* Allocate(size_t size) {
+    if (size == 0) size = 1;
+
+    void* pointer;
+    while ((pointer = malloc(size)) == nullptr) {
+      std::new_handler handler = std::get_new_handler();
+      if (handler == nullptr) return nullptr;
+      handler();
+    }
+
+    CountAllocation(size);
+    return pointer;
+}
+
+const bool installed = (MarkAllocationHooksInstalled(), true);
+
+}  // namespace
+
+
+/* ############################################################################ */
+/* ####################### FUNCTION IMPLEMENTATIONS ########################### */
+/* ############################################################################ */
+
+
+void* operator new(size_t size) {
+    void* pointer = Allocate(size);
+    if (pointer == nullptr) throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new[](size_t size) {
+    void* pointer = Allocate(size);
+    if (pointer == nullptr) throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+      return Allocate(size);
+    } catch (...) {
+      return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+      return Allocate(size);
+    } catch (...) {
+      return nullptr;
+    }
+}
+
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete[](void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { free(pointer); }
@@ -0,0 +1,221 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "alloc_tracker.h"
+
+#include <execinfo.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "opencensus/stats/stats.h"
+#include "opencensus/tags/tag_key.h"
+
+
+/* ############################################################################ */
+/* ################################# METRICS ################################## */
+/* ############################################################################ */
+
+opencensus::tags::TagKey allocation_method_key = opencensus::tags::TagKey::Register("Method");
+
+/* --------------------------- RPC ALLOCATIONS METRIC -------------------------- */
+ABSL_CONST_INIT const absl::string_view rpc_allocations_measure_name = "rpc allocations";
+
+const opencensus::stats::MeasureInt64 rpc_allocations_measure =
+     opencensus::stats::MeasureInt64::Register(rpc_allocations_measure_name,
+                                                "Heap allocations made while handling an rpc",
+                                                "allocations");
+
+/* ------------------------- RPC ALLOCATED BYTES METRIC ------------------------ */
+ABSL_CONST_INIT const absl::string_view rpc_allocated_bytes_measure_name = "rpc allocated bytes";
+
+const opencensus::stats::MeasureInt64 rpc_allocated_bytes_measure =
+     opencensus::stats::MeasureInt64::Register(rpc_allocated_bytes_measure_name,
+                                                "Bytes allocated on the heap while handling an rpc",
+                                                "By");
+
+
+/* ############################################################################ */
+/* ############################ HELPER FUNCTIONS ############################## */
+/* ############################################################################ */
+
+namespace {
+
+/*
+* Powers of 4 from 1 up to 'max'.
+*/
+std::vector<double> PowersOfFour(double max) {
+    std::vector<double> boundaries = {0};
+    for (double boundary = 1; boundary <= max; boundary *= 4) {
+      boundaries.push_back(boundary);
+    }
+    return boundaries;
+}
+
+// Set once the operator new/delete replacements are linked in
+std::atomic<bool> hooks_installed(false);
+
+// Allocations made by each thread. Plain integers, constant initialized, so
+// that operator new can update them before anything else is set up.
+thread_local uint64_t thread_allocations = 0;
+thread_local uint64_t thread_bytes = 0;
+
+// Allocation sampling. The samples are filled from operator new, so they
+// are allocated once up front.
+const int kMaxAllocationSamples = 1 << 14;
+AllocationSample* samples = nullptr;
+std::atomic<int> sample_count(0);
+std::atomic<bool> sampling(false);
+std::atomic<uint64_t> sample_interval(0);
+
+// Threads inside SampleAllocation(), waited for when sampling stops
+std::atomic<int> samplers_running(0);
+
+// Guards starting and stopping
+std::mutex sampling_mu;
+bool sampling_started = false;
+
+// Bytes the thread may still allocate before its next sample
+thread_local int64_t bytes_until_sample = 0;
+
+// Set while the thread takes a sample, which may allocate in backtrace()
+thread_local bool in_sampler = false;
+
+__attribute__((noinline)) void SampleAllocation(size_t size) {
+    if (in_sampler) return;
+    in_sampler = true;
+
+    samplers_running.fetch_add(1);
+    if (sampling.load()) {
+      const int index = sample_count.fetch_add(1, std::memory_order_relaxed);
+      if (index < kMaxAllocationSamples) {
+        samples[index].bytes = size;
+        samples[index].depth = backtrace(samples[index].pcs, AllocationSample::kMaxDepth);
+      }
+    }
+    samplers_running.fetch_sub(1);
+
+    in_sampler = false;
+}
+
+}  // namespace
+
+
+/* ############################################################################ */
+/* ####################### FUNCTION IMPLEMENTATIONS ########################### */
+/* ############################################################################ */
+
+
+AllocationScope::AllocationScope(const char* name)
+    : name_(name), start_allocations_(thread_allocations), start_bytes_(thread_bytes) {}
+
+AllocationScope::~AllocationScope() {
+    if (!Enabled()) return;
+
+    // Read before recording, which allocates
+    const int64_t allocations = this->allocations();
+    const int64_t bytes = this->bytes();
+    opencensus::stats::Record({{rpc_allocations_measure, allocations},
+                               {rpc_allocated_bytes_measure, bytes}},
+                              {{allocation_method_key, name_}});
+}
+
+uint64_t AllocationScope::allocations() const {
+    return thread_allocations - start_allocations_;
+}
+
+uint64_t AllocationScope::bytes() const {
+    return thread_bytes - start_bytes_;
+}
+
+bool AllocationScope::Enabled() {
+    return hooks_installed.load(std::memory_order_relaxed);
+}
+
+
+void RegisterAllocationViewsForExport() {
+    if (!AllocationScope::Enabled()) return;
+
+    opencensus::stats::ViewDescriptor()
+        .set_name("food_system/rpc_allocations")
+        .set_measure(rpc_allocations_measure_name)
+        .set_aggregation(opencensus::stats::Aggregation::Distribution(
+                    opencensus::stats::BucketBoundaries::Explicit(PowersOfFour(1 << 20))))
+        .add_column(allocation_method_key)
+        .set_description("Heap allocations per rpc")
+        .RegisterForExport();
+
+    opencensus::stats::ViewDescriptor()
+        .set_name("food_system/rpc_allocated_bytes")
+        .set_measure(rpc_allocated_bytes_measure_name)
+        .set_aggregation(opencensus::stats::Aggregation::Distribution(
+                    opencensus::stats::BucketBoundaries::Explicit(PowersOfFour(1 << 30))))
+        .add_column(allocation_method_key)
+        .set_description("Bytes allocated on the heap per rpc")
+        .RegisterForExport();
+}
+
+
+bool StartAllocationSampling(uint64_t interval_bytes) {
+    std::lock_guard<std::mutex> lock(sampling_mu);
+    if (!AllocationScope::Enabled() || sampling_started) return false;
+    sampling_started = true;
+
+    if (samples == nullptr) samples = new AllocationSample[kMaxAllocationSamples];
+
+    // The first backtrace() call loads libgcc, which must not happen while sampling
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    sample_count.store(0);
+    sample_interval.store(interval_bytes);
+    sampling.store(true);
+    return true;
+}
+
+std::vector<AllocationSample> StopAllocationSampling() {
+    std::lock_guard<std::mutex> lock(sampling_mu);
+    if (!sampling_started) return {};
+    sampling_started = false;
+
+    // Let samples being taken finish before reading them
+    sampling.store(false);
+    while (samplers_running.load() > 0) std::this_thread::yield();
+
+    const int count = std::min(sample_count.load(), kMaxAllocationSamples);
+    return std::vector<AllocationSample>(samples, samples + count);
+}
+
+
+void CountAllocation(size_t size) {
+    thread_allocations++;
+    thread_bytes += size;
+
+    if (!sampling.load(std::memory_order_relaxed)) return;
+    bytes_until_sample -= size;
+    if (bytes_until_sample > 0) return;
+    bytes_until_sample = sample_interval.load(std::memory_order_relaxed);
+    SampleAllocation(size);
+}
+
+void MarkAllocationHooksInstalled() {
+    hooks_installed.store(true, std::memory_order_relaxed);
+}
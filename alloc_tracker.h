@@ -0,0 +1,119 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/*
+* Counts the heap allocations made by the current thread while an RPC is
+* handled, and records them under the RPC's name:
+*
+*   food_system/rpc_allocations      - Allocations per RPC
+*   food_system/rpc_allocated_bytes  - Bytes allocated per RPC
+*
+* Counting needs the global operator new/delete replacements of the
+* alloc_hooks library, which is only linked in when building with
+* --define alloc_tracking=1. Without them every scope is a no-op.
+*
+* Only the thread running the scope is counted, not the gRPC threads which
+* do work for the RPC in the background.
+*/
+class AllocationScope {
+  public:
+    /*
+    * @param name - The RPC type, used as the Method tag. Must outlive the scope.
+    */
+    explicit AllocationScope(const char* name);
+
+    /*
+    * Records the allocations made since construction.
+    */
+    ~AllocationScope();
+
+    /*
+    * @return count - Allocations made by this thread since construction
+    */
+    uint64_t allocations() const;
+
+    /*
+    * @return bytes - Bytes allocated by this thread since construction
+    */
+    uint64_t bytes() const;
+
+    /*
+    * @return enabled - Whether the allocation hooks are linked in
+    */
+    static bool Enabled();
+
+  private:
+    const char* name_;
+    const uint64_t start_allocations_;
+    const uint64_t start_bytes_;
+};
+
+
+/*
+* Registers the allocation views for export, if the hooks are linked in.
+*/
+void RegisterAllocationViewsForExport();
+
+
+/*
+* An allocation picked by allocation sampling: its size and the stack it
+* was made from, operator new included.
+*/
+struct AllocationSample {
+  static const int kMaxDepth = 32;
+
+  uint64_t bytes;
+  int depth;
+  void* pcs[kMaxDepth];
+};
+
+
+/*
+* Starts recording the stack of about one allocation per 'interval_bytes'
+* allocated by each thread, e.g. for a heap profile over some time.
+*
+* @param interval_bytes - Bytes allocated between two samples
+* @return false - If the hooks are not linked in, or sampling is already on
+*/
+bool StartAllocationSampling(uint64_t interval_bytes);
+
+
+/*
+* Stops the sampling started by StartAllocationSampling().
+*
+* @return samples - The sampled allocations, at most a few thousand
+*/
+std::vector<AllocationSample> StopAllocationSampling();
+
+
+/*
+* Called by the allocation hooks. Must not allocate.
+*/
+void CountAllocation(size_t size);
+void MarkAllocationHooksInstalled();
+
+
+#endif
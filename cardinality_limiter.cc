@@ -0,0 +1,71 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "cardinality_limiter.h"
+
+
+namespace {
+
+// Tag value for everything folded away
+const char kOtherValue[] = "other";
+
+// How many candidates are tracked per admitted value
+const size_t kCandidatesPerValue = 4;
+
+}  // namespace
+
+
+CardinalityLimiter::CardinalityLimiter(size_t max_values, int min_count)
+    : max_values_(max_values), min_count_(min_count) {}
+
+std::string CardinalityLimiter::Limit(absl::string_view value) {
+    std::string key(value);
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (admitted_.count(key)) return key;
+    if (admitted_.size() >= max_values_) return kOtherValue;
+
+    auto it = candidates_.find(key);
+    if (it == candidates_.end()) {
+      if (candidates_.size() >= max_values_ * kCandidatesPerValue) {
+        Decay();
+        if (candidates_.size() >= max_values_ * kCandidatesPerValue) return kOtherValue;
+      }
+      it = candidates_.emplace(key, 0).first;
+    }
+
+    if (++it->second < min_count_) return kOtherValue;
+
+    candidates_.erase(it);
+    admitted_.insert(key);
+
+    // Nothing else can be admitted: the candidates are no longer needed
+    if (admitted_.size() >= max_values_) candidates_.clear();
+    return key;
+}
+
+void CardinalityLimiter::Decay() {
+    for (auto it = candidates_.begin(); it != candidates_.end();) {
+      it->second /= 2;
+      if (it->second == 0) {
+        it = candidates_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef CARDINALITY_LIMITER_H
+#define CARDINALITY_LIMITER_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "absl/strings/string_view.h"
+
+
+/*
+* Bounds the number of distinct values a tag key takes, so that a view
+* tagged by an open-ended value (e.g. a vendor name) cannot grow without
+* limit. A value gets its own tag value once it has been seen 'min_count'
+* times, as long as fewer than 'max_values' values got one before it.
+* Every other value is folded into "other".
+*/
+class CardinalityLimiter {
+  public:
+    /*
+    * @param max_values - The most distinct values passed through
+    * @param min_count - How often a value must be seen before it is passed through
+    */
+    CardinalityLimiter(size_t max_values, int min_count);
+
+    /*
+    * @param value - The raw tag value
+    * @return value - 'value' itself, or "other" if it is rare or over the limit
+    */
+    std::string Limit(absl::string_view value);
+
+  private:
+    /*
+    * Halves the sightings of every candidate and forgets those left with
+    * none, to make room for new values once the candidates fill up.
+    * Values seen often recently keep their lead.
+    */
+    void Decay();
+
+    std::mutex mu_;
+    const size_t max_values_;
+    const int min_count_;
+
+    // Values passed through
+    std::unordered_set<std::string> admitted_;
+
+    // Sightings of values not admitted yet. Bounded too, so that a stream of
+    // one-off values cannot grow it either: it decays each time it is full.
+    std::unordered_map<std::string, int> candidates_;
+};
+
+
+#endif
@@ -0,0 +1,615 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "diagnostics.h"
+
+#include <arpa/inet.h>
+#include <cxxabi.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <libgen.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "alloc_tracker.h"
+#include "opencensus/stats/stats.h"
+#include "opencensus/trace/exporter/span_data.h"
+#include "opencensus/trace/exporter/span_exporter.h"
+
+
+namespace {
+
+/* ############################################################################ */
+/* ################################## SPANS ################################### */
+/* ############################################################################ */
+
+// A finished span, as shown on /tracez
+struct SpanSummary {
+  std::string name;
+  std::string trace_id;
+  std::string span_id;
+  std::string status;
+  absl::Time start;
+  absl::Duration duration;
+};
+
+/*
+* Keeps the most recent spans and the slowest spans seen since startup.
+*/
+class SpanRecorder : public opencensus::trace::exporter::SpanExporter::Handler {
+  public:
+    static const size_t kRecentSpans = 100;
+    static const size_t kSlowSpans = 20;
+
+    void Export(const std::vector<opencensus::trace::exporter::SpanData>& spans) override {
+      std::lock_guard<std::mutex> lock(mu_);
+      for (const opencensus::trace::exporter::SpanData& span : spans) {
+        SpanSummary summary;
+        summary.name = std::string(span.name());
+        summary.trace_id = span.context().trace_id().ToHex();
+        summary.span_id = span.context().span_id().ToHex();
+        summary.status = span.status().ToString();
+        summary.start = span.start_time();
+        summary.duration = span.end_time() - span.start_time();
+
+        recent_.push_back(summary);
+        if (recent_.size() > kRecentSpans) recent_.pop_front();
+
+        // 'slow_' is sorted from slowest to fastest
+        if (slow_.size() < kSlowSpans || summary.duration > slow_.back().duration) {
+          auto it = std::upper_bound(slow_.begin(), slow_.end(), summary,
+                                     [](const SpanSummary& a, const SpanSummary& b) { return a.duration > b.duration; });
+          slow_.insert(it, summary);
+          if (slow_.size() > kSlowSpans) slow_.pop_back();
+        }
+      }
+    }
+
+    std::string Render() {
+      std::lock_guard<std::mutex> lock(mu_);
+      std::string page = absl::StrCat("Slowest spans (", slow_.size(), ")\n");
+      for (const SpanSummary& span : slow_) AppendSpan(span, &page);
+
+      absl::StrAppend(&page, "\nRecent spans (", recent_.size(), ")\n");
+      for (auto it = recent_.rbegin(); it != recent_.rend(); it++) AppendSpan(*it, &page);
+      return page;
+    }
+
+  private:
+    static void AppendSpan(const SpanSummary& span, std::string* page) {
+      absl::StrAppend(page, "  ", absl::FormatTime(span.start), "  ",
+                      absl::FormatDuration(span.duration), "  ", span.name,
+                      "  trace_id=", span.trace_id, " span_id=", span.span_id,
+                      "  ", span.status, "\n");
+    }
+
+    std::mutex mu_;
+    std::deque<SpanSummary> recent_;
+    std::vector<SpanSummary> slow_;
+};
+
+
+/* ############################################################################ */
+/* ################################## STATS ################################### */
+/* ############################################################################ */
+
+/*
+* Keeps the data of the latest stats export.
+*/
+class StatsRecorder : public opencensus::stats::StatsExporter::Handler {
+  public:
+    void ExportViewData(
+        const std::vector<std::pair<opencensus::stats::ViewDescriptor, opencensus::stats::ViewData>>& data) override {
+      std::lock_guard<std::mutex> lock(mu_);
+      latest_ = data;
+    }
+
+    std::string Render() {
+      std::lock_guard<std::mutex> lock(mu_);
+      std::string page;
+      for (const auto& view : latest_) {
+        const opencensus::stats::ViewDescriptor& descriptor = view.first;
+        const opencensus::stats::ViewData& data = view.second;
+
+        std::vector<std::string> columns;
+        for (const auto& column : descriptor.columns()) columns.push_back(column.name());
+
+        absl::StrAppend(&page, descriptor.name(), " - ", descriptor.description(),
+                        "\n  [", absl::StrJoin(columns, ", "), "]\n");
+
+        switch (data.type()) {
+          case opencensus::stats::ViewData::Type::kDouble:
+            for (const auto& row : data.double_data()) {
+              absl::StrAppend(&page, "  ", absl::StrJoin(row.first, ", "), ": ", row.second, "\n");
+            }
+            break;
+          case opencensus::stats::ViewData::Type::kInt64:
+            for (const auto& row : data.int_data()) {
+              absl::StrAppend(&page, "  ", absl::StrJoin(row.first, ", "), ": ", row.second, "\n");
+            }
+            break;
+          case opencensus::stats::ViewData::Type::kDistribution:
+            for (const auto& row : data.distribution_data()) {
+              absl::StrAppend(&page, "  ", absl::StrJoin(row.first, ", "), ": count=", row.second.count(),
+                              " mean=", row.second.mean(),
+                              " buckets=[", absl::StrJoin(row.second.bucket_counts(), ", "), "]\n");
+            }
+            break;
+        }
+      }
+      return page.empty() ? "No stats exported yet\n" : page;
+    }
+
+  private:
+    std::mutex mu_;
+    std::vector<std::pair<opencensus::stats::ViewDescriptor, opencensus::stats::ViewData>> latest_;
+};
+
+// Owned by the exporters once registered
+SpanRecorder* span_recorder = nullptr;
+StatsRecorder* stats_recorder = nullptr;
+
+
+/* ############################################################################ */
+/* ################################## GAUGES ################################## */
+/* ############################################################################ */
+
+std::mutex gauges_mu;
+std::vector<std::pair<std::string, std::function<int64_t()>>>* gauges =
+    new std::vector<std::pair<std::string, std::function<int64_t()>>>();
+
+std::string RenderGauges() {
+    std::lock_guard<std::mutex> lock(gauges_mu);
+    std::string page;
+    for (const auto& gauge : *gauges) {
+      absl::StrAppend(&page, gauge.first, " ", gauge.second(), "\n");
+    }
+    return page.empty() ? "No gauges registered\n" : page;
+}
+
+
+/* ############################################################################ */
+/* ################################# THREADS ################################## */
+/* ############################################################################ */
+
+/*
+* Lists every thread of the process with its state and CPU time, from /proc.
+*/
+std::string RenderThreads() {
+    const long ticks_per_second = sysconf(_SC_CLK_TCK);
+    std::string page = "tid\tstate\tuser_ms\tsys_ms\tname\n";
+
+    DIR* dir = opendir("/proc/self/task");
+    if (dir == nullptr) return absl::StrCat("Cannot read /proc/self/task: ", strerror(errno), "\n");
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] == '.') continue;
+
+      std::ifstream stat_file(absl::StrCat("/proc/self/task/", entry->d_name, "/stat"));
+      std::string stat((std::istreambuf_iterator<char>(stat_file)), std::istreambuf_iterator<char>());
+
+      // The name is in parentheses and may contain spaces: split around it
+      const size_t open = stat.find('(');
+      const size_t close = stat.rfind(')');
+      if (open == std::string::npos || close == std::string::npos) continue;
+
+      const std::string name = stat.substr(open + 1, close - open - 1);
+      std::vector<std::string> fields = absl::StrSplit(stat.substr(close + 2), ' ');
+
+      // Fields after the name start at "state"; utime and stime are the 12th and 13th
+      if (fields.size() < 13) continue;
+      const long user_ms = atol(fields[11].c_str()) * 1000 / ticks_per_second;
+      const long sys_ms = atol(fields[12].c_str()) * 1000 / ticks_per_second;
+
+      absl::StrAppend(&page, entry->d_name, "\t", fields[0], "\t", user_ms, "\t", sys_ms, "\t", name, "\n");
+    }
+    closedir(dir);
+    return page;
+}
+
+
+/* ############################################################################ */
+/* ################################ PROFILER ################################## */
+/* ############################################################################ */
+
+const int kMaxProfileDepth = 32;
+const int kMaxProfileSamples = 1 << 15;
+
+// Frames of the signal handler and the signal trampoline on top of each sample
+const int kProfileSkippedFrames = 2;
+
+struct ProfileSample {
+  int depth;
+  void* pcs[kMaxProfileDepth];
+};
+
+// Filled from the SIGPROF handler, so allocated once up front
+ProfileSample* profile_samples = nullptr;
+std::atomic<int> profile_sample_count(0);
+std::atomic<bool> profiling(false);
+
+void ProfileSignalHandler(int) {
+    const int saved_errno = errno;
+    const int index = profile_sample_count.fetch_add(1, std::memory_order_relaxed);
+    if (index < kMaxProfileSamples) {
+      profile_samples[index].depth = backtrace(profile_samples[index].pcs, kMaxProfileDepth);
+    }
+    errno = saved_errno;
+}
+
+/*
+* @return name - The demangled name of the function containing 'pc', or
+*                its binary and offset in it when the name isn't exported
+*/
+std::string Symbolize(void* pc) {
+    Dl_info info;
+    if (dladdr(pc, &info) == 0 || info.dli_fname == nullptr) {
+      return absl::StrCat("0x", absl::Hex(reinterpret_cast<uintptr_t>(pc)));
+    }
+    if (info.dli_sname == nullptr) {
+      // The offset stays valid across runs of a PIE binary, for addr2line -e <binary>
+      std::string file = info.dli_fname;
+      return absl::StrCat(basename(&file[0]), "+0x",
+                          absl::Hex(reinterpret_cast<uintptr_t>(pc) - reinterpret_cast<uintptr_t>(info.dli_fbase)));
+    }
+
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+    return name;
+}
+
+/*
+* @return stack - The frames pcs[depth - 1] (outermost) to pcs[first], folded
+*                 as "a;b;c", symbolizing every address once across calls
+*/
+std::string FoldStack(void* const* pcs, int depth, int first, std::map<void*, std::string>* symbols) {
+    std::vector<std::string> frames;
+    for (int j = depth - 1; j >= first; j--) {
+      auto it = symbols->find(pcs[j]);
+      if (it == symbols->end()) it = symbols->insert({pcs[j], Symbolize(pcs[j])}).first;
+      frames.push_back(it->second);
+    }
+    return absl::StrJoin(frames, ";");
+}
+
+/*
+* @return page - Folded stacks and their weight, heaviest first
+*/
+template <typename Weight>
+std::string RenderStacks(const std::map<std::string, Weight>& stacks) {
+    std::vector<std::pair<std::string, Weight>> sorted(stacks.begin(), stacks.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<std::string, Weight>& a, const std::pair<std::string, Weight>& b) { return a.second > b.second; });
+
+    std::string page;
+    for (const auto& stack : sorted) absl::StrAppend(&page, stack.first, " ", stack.second, "\n");
+    return page;
+}
+
+/*
+* Samples the stacks of the threads using CPU for 'seconds', 'hz' times
+* per second of CPU time, and returns them as folded stacks ("a;b;c count"),
+* ready for flamegraph.pl.
+*/
+std::string RenderProfile(int seconds, int hz) {
+    if (profiling.exchange(true)) return "A profile is already being taken\n";
+
+    if (profile_samples == nullptr) profile_samples = new ProfileSample[kMaxProfileSamples];
+
+    // The first backtrace() call loads libgcc, which must not happen in the handler
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    profile_sample_count.store(0);
+
+    struct sigaction action;
+    struct sigaction previous_action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = ProfileSignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &previous_action);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+
+    absl::SleepFor(absl::Seconds(seconds));
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &previous_action, nullptr);
+
+    const int samples = std::min(profile_sample_count.load(), kMaxProfileSamples);
+
+    // Fold identical stacks
+    std::map<void*, std::string> symbols;
+    std::map<std::string, int> stacks;
+    for (int i = 0; i < samples; i++) {
+      const ProfileSample& sample = profile_samples[i];
+      stacks[FoldStack(sample.pcs, sample.depth, kProfileSkippedFrames, &symbols)]++;
+    }
+    profiling.store(false);
+
+    return absl::StrCat("# ", samples, " samples over ", seconds, "s at ", hz, "Hz\n", RenderStacks(stacks));
+}
+
+
+/* ############################################################################ */
+/* ################################### HEAP ################################### */
+/* ############################################################################ */
+
+/*
+* @return bytes - Bytes the allocator has handed out and not got back
+*/
+uint64_t InUseBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    return info.uordblks + info.hblkhd;
+}
+
+/*
+* Samples about one allocation per 'sample_bytes' allocated for 'seconds',
+* and returns the stacks that allocated, as folded stacks weighted by the
+* bytes they are estimated to have allocated.
+*/
+std::string RenderAllocations(int seconds, int sample_bytes) {
+    if (!AllocationScope::Enabled()) {
+      return "# Allocation sampling needs a build with --define alloc_tracking=1\n";
+    }
+    const uint64_t in_use_before = InUseBytes();
+    if (!StartAllocationSampling(sample_bytes)) return "# Allocations are already being sampled\n";
+    absl::SleepFor(absl::Seconds(seconds));
+    const std::vector<AllocationSample> samples = StopAllocationSampling();
+    const uint64_t in_use_after = InUseBytes();
+
+    // Drop the hooks' own frames: everything up to the outermost operator new
+    std::map<void*, std::string> symbols;
+    std::map<std::string, uint64_t> stacks;
+    for (const AllocationSample& sample : samples) {
+      int first = 0;
+      for (int j = 0; j < sample.depth; j++) {
+        auto it = symbols.find(sample.pcs[j]);
+        if (it == symbols.end()) it = symbols.insert({sample.pcs[j], Symbolize(sample.pcs[j])}).first;
+        if (it->second.find("operator new") != std::string::npos) first = j + 1;
+      }
+      // A sample stands for the allocations since the previous one
+      stacks[FoldStack(sample.pcs, sample.depth, first, &symbols)] += std::max<uint64_t>(sample.bytes, sample_bytes);
+    }
+
+    return absl::StrCat("# ", samples.size(), " allocations sampled over ", seconds, "s, one per ",
+                        sample_bytes, " bytes\n# in_use_bytes ", in_use_before, " -> ", in_use_after, "\n",
+                        RenderStacks(stacks));
+}
+
+/*
+* Reports the allocator's view of the heap and the process' memory usage,
+* followed by an allocation profile over 'seconds' if that is not 0.
+*/
+std::string RenderHeap(int seconds, int sample_bytes) {
+    std::string page;
+
+    std::ifstream status_file("/proc/self/status");
+    std::string line;
+    while (std::getline(status_file, line)) {
+      if (line.compare(0, 2, "Vm") == 0 || line.compare(0, 3, "Rss") == 0) absl::StrAppend(&page, line, "\n");
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    absl::StrAppend(&page, "\nheap_bytes ", info.arena, "\nmmap_bytes ", info.hblkhd,
+                    "\nin_use_bytes ", info.uordblks, "\nfree_bytes ", info.fordblks,
+                    "\nreleasable_bytes ", info.keepcost, "\n\n");
+
+    // Per-arena detail, as XML
+    char* buffer = nullptr;
+    size_t size = 0;
+    FILE* stream = open_memstream(&buffer, &size);
+    if (stream != nullptr) {
+      malloc_info(0, stream);
+      fclose(stream);
+      page.append(buffer, size);
+      free(buffer);
+    }
+
+    if (seconds > 0) absl::StrAppend(&page, "\n", RenderAllocations(seconds, sample_bytes));
+    return page;
+}
+
+
+/* ############################################################################ */
+/* ################################ HTTP SERVER ############################### */
+/* ############################################################################ */
+
+/*
+* @return value - The integer query parameter 'key' clamped to [low, high], or 'fallback'
+*/
+int QueryInt(const std::map<std::string, std::string>& query, const std::string& key,
+             int fallback, int low, int high) {
+    auto it = query.find(key);
+    if (it == query.end()) return fallback;
+    return std::max(low, std::min(high, atoi(it->second.c_str())));
+}
+
+/*
+* @return body - The page for 'path', or an empty string if there is none
+*/
+std::string Dispatch(const std::string& path, const std::map<std::string, std::string>& query) {
+    if (path == "/tracez") return span_recorder->Render();
+    if (path == "/statsz") return stats_recorder->Render();
+    if (path == "/varz") return RenderGauges();
+    if (path == "/threadz") return RenderThreads();
+    if (path == "/profilez") return RenderProfile(QueryInt(query, "seconds", 5, 1, 60), QueryInt(query, "hz", 100, 1, 1000));
+    if (path == "/heapz") {
+      return RenderHeap(QueryInt(query, "seconds", 0, 0, 60), QueryInt(query, "sample_bytes", 512 * 1024, 1, 1 << 30));
+    }
+    if (path == "/") {
+      return "/tracez\n/statsz\n/varz\n/threadz\n/profilez?seconds=5&hz=100\n/heapz?seconds=0&sample_bytes=524288\n";
+    }
+    return "";
+}
+
+void HandleConnection(int fd) {
+    // Only the request line matters
+    std::string request;
+    char buffer[4096];
+    while (request.find("\r\n") == std::string::npos && request.size() < sizeof(buffer)) {
+      const ssize_t n = read(fd, buffer, sizeof(buffer));
+      if (n <= 0) break;
+      request.append(buffer, n);
+    }
+
+    std::vector<std::string> parts = absl::StrSplit(request.substr(0, request.find("\r\n")), ' ');
+    std::string status = "200 OK";
+    std::string body;
+    if (parts.size() < 2 || parts[0] != "GET") {
+      status = "405 Method Not Allowed";
+    } else {
+      std::vector<std::string> target = absl::StrSplit(parts[1], absl::MaxSplits('?', 1));
+      std::map<std::string, std::string> query;
+      if (target.size() > 1) {
+        for (absl::string_view param : absl::StrSplit(target[1], '&')) {
+          std::pair<std::string, std::string> kv = absl::StrSplit(param, absl::MaxSplits('=', 1));
+          query[kv.first] = kv.second;
+        }
+      }
+      body = Dispatch(target[0], query);
+      if (body.empty()) status = "404 Not Found";
+    }
+
+    const std::string response = absl::StrCat("HTTP/1.0 ", status, "\r\nContent-Type: text/plain\r\n",
+                                              "Content-Length: ", body.size(), "\r\nConnection: close\r\n\r\n", body);
+    size_t offset = 0;
+    while (offset < response.size()) {
+      const ssize_t n = write(fd, response.data() + offset, response.size() - offset);
+      if (n <= 0) break;
+      offset += n;
+    }
+    close(fd);
+}
+
+// How long a connection may take to send its request line
+const int kReadTimeoutSeconds = 5;
+
+void ServeLoop(int listen_fd) {
+    while (true) {
+      const int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        std::cerr << "Diagnostics server stopped: " << strerror(errno) << "\n";
+        return;
+      }
+
+      struct timeval timeout;
+      timeout.tv_sec = kReadTimeoutSeconds;
+      timeout.tv_usec = 0;
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+      // A thread per connection, so a profile or a stalled client doesn't hold up the other pages
+      std::thread(HandleConnection, fd).detach();
+    }
+}
+
+}  // namespace
+
+
+void StartDiagnosticsServer() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+      const char* port_env = getenv("DIAGNOSTICS_PORT");
+      if (port_env == nullptr) {
+        std::cerr << "The DIAGNOSTICS_PORT environment variable is not set: "
+                     "not serving diagnostics. (e.g. 8080)\n";
+        return;
+      }
+
+      const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (listen_fd < 0) {
+        std::cerr << "Cannot serve diagnostics: " << strerror(errno) << "\n";
+        return;
+      }
+      const int one = 1;
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+      // Only reachable from the local host
+      struct sockaddr_in address;
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      address.sin_port = htons(atoi(port_env));
+      if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 ||
+          listen(listen_fd, 16) < 0) {
+        std::cerr << "Cannot serve diagnostics on port " << port_env << ": " << strerror(errno) << "\n";
+        close(listen_fd);
+        return;
+      }
+
+      span_recorder = new SpanRecorder();
+      opencensus::trace::exporter::SpanExporter::RegisterHandler(
+          std::unique_ptr<opencensus::trace::exporter::SpanExporter::Handler>(span_recorder));
+      stats_recorder = new StatsRecorder();
+      opencensus::stats::StatsExporter::RegisterPushHandler(
+          std::unique_ptr<opencensus::stats::StatsExporter::Handler>(stats_recorder));
+
+      std::cout << "Diagnostics on http://127.0.0.1:" << port_env << "/\n";
+      std::thread(ServeLoop, listen_fd).detach();
+    });
+}
+
+void RegisterDiagnosticsGauge(const std::string& name, std::function<int64_t()> read) {
+    std::lock_guard<std::mutex> lock(gauges_mu);
+    gauges->push_back({name, std::move(read)});
+}
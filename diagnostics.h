@@ -0,0 +1,54 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+
+/*
+* Starts the in-process diagnostics HTTP server on 127.0.0.1 if the
+* DIAGNOSTICS_PORT environment variable is set. Only the first call in a
+* process starts it. The server offers these pages:
+*
+*   /tracez                      - Recent spans, and the slowest spans seen
+*   /statsz                      - Latest data of every exported stats view
+*   /varz                        - Gauges registered with RegisterDiagnosticsGauge()
+*   /threadz                     - State and CPU time of every thread
+*   /profilez?seconds=N&hz=M     - Sampling CPU profile, as folded stacks
+*   /heapz?seconds=N&sample_bytes=M
+*                                - Heap statistics from the allocator, then
+*                                  the stacks allocating over N seconds, as
+*                                  folded stacks (needs the allocation hooks)
+*/
+void StartDiagnosticsServer();
+
+
+/*
+* Adds a gauge to the /varz page, read each time the page is served.
+*
+* @param name - Name of the gauge
+* @param read - Returns the current value. Called from the diagnostics thread.
+*/
+void RegisterDiagnosticsGauge(const std::string& name, std::function<int64_t()> read);
+
+
+#endif
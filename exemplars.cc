@@ -0,0 +1,201 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "exemplars.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "opencensus/stats/stats.h"
+#include "opencensus/trace/span_id.h"
+#include "opencensus/trace/trace_id.h"
+
+
+/* ############################################################################ */
+/* ############################ HELPER FUNCTIONS ############################## */
+/* ############################################################################ */
+
+namespace {
+
+/*
+* Hex encodes the bytes of 'words', in memory order.
+*/
+std::string ToHex(const uint64_t* words, size_t count) {
+    static const char kDigits[] = "0123456789abcdef";
+
+    uint8_t bytes[16];
+    memcpy(bytes, words, count * sizeof(uint64_t));
+
+    std::string hex;
+    for (size_t i = 0; i < count * sizeof(uint64_t); i++) {
+      hex += kDigits[bytes[i] >> 4];
+      hex += kDigits[bytes[i] & 0xf];
+    }
+    return hex;
+}
+
+// Reservoirs dumped on export, by view name
+std::mutex registry_mu;
+std::vector<std::pair<std::string, const ExemplarReservoir*>>* registry = nullptr;
+
+/*
+* Prints the exemplars of every registered view each time the stats
+* exporters run, next to the stdout exporter's dump of the view itself.
+*/
+class ExemplarExportHandler : public opencensus::stats::StatsExporter::Handler {
+  public:
+    void ExportViewData(
+        const std::vector<std::pair<opencensus::stats::ViewDescriptor, opencensus::stats::ViewData>>& data) override {
+      std::lock_guard<std::mutex> lock(registry_mu);
+      for (const auto& view : data) {
+        for (const auto& entry : *registry) {
+          if (entry.first != view.first.name()) continue;
+
+          std::string dump = absl::StrCat("Exemplars for ", entry.first, ":\n");
+          for (const ExemplarReservoir::Exemplar& exemplar : entry.second->Snapshot()) {
+            absl::StrAppend(&dump, "  [", exemplar.lower_bound, ", ", exemplar.upper_bound, "): ",
+                            exemplar.value, " at ", absl::FormatTime(exemplar.time),
+                            " trace_id=", exemplar.trace_id, " span_id=", exemplar.span_id, "\n");
+          }
+          std::cout << dump;
+        }
+      }
+    }
+};
+
+}  // namespace
+
+
+/* ############################################################################ */
+/* ####################### FUNCTION IMPLEMENTATIONS ########################### */
+/* ############################################################################ */
+
+
+ExemplarReservoir::ExemplarReservoir(const std::vector<double>& boundaries, absl::Duration window)
+    : boundaries_(boundaries), window_ns_(absl::ToInt64Nanoseconds(window)),
+      slots_(new Slot[boundaries.size() + 1]) {
+    for (size_t i = 0; i <= boundaries_.size(); i++) {
+      Slot& slot = slots_[i];
+      slot.sequence.store(0, std::memory_order_relaxed);
+      slot.value.store(0, std::memory_order_relaxed);
+      slot.time_ns.store(0, std::memory_order_relaxed);
+      slot.trace_id_high.store(0, std::memory_order_relaxed);
+      slot.trace_id_low.store(0, std::memory_order_relaxed);
+      slot.span_id.store(0, std::memory_order_relaxed);
+    }
+}
+
+void ExemplarReservoir::Record(double value, const opencensus::trace::SpanContext& context) {
+    // Same bucketing as the view: bucket i holds [boundaries[i - 1], boundaries[i])
+    const size_t bucket = std::upper_bound(boundaries_.begin(), boundaries_.end(), value) - boundaries_.begin();
+    Slot& slot = slots_[bucket];
+
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    if (sequence & 1) return;
+
+    // Keep the slowest sample, unless it has gone stale
+    const int64_t now_ns = absl::GetCurrentTimeNanos();
+    const int64_t time_ns = slot.time_ns.load(std::memory_order_relaxed);
+    if (time_ns != 0 && value < slot.value.load(std::memory_order_relaxed) && now_ns - time_ns < window_ns_) {
+      return;
+    }
+
+    // Another writer got there first: drop this sample rather than wait
+    if (!slot.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) return;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t trace_id[2];
+    uint64_t span_id;
+    static_assert(opencensus::trace::TraceId::kSize == sizeof(trace_id), "unexpected trace id size");
+    static_assert(opencensus::trace::SpanId::kSize == sizeof(span_id), "unexpected span id size");
+    context.trace_id().CopyTo(reinterpret_cast<uint8_t*>(trace_id));
+    context.span_id().CopyTo(reinterpret_cast<uint8_t*>(&span_id));
+
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.time_ns.store(now_ns, std::memory_order_relaxed);
+    slot.trace_id_high.store(trace_id[0], std::memory_order_relaxed);
+    slot.trace_id_low.store(trace_id[1], std::memory_order_relaxed);
+    slot.span_id.store(span_id, std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+std::vector<ExemplarReservoir::Exemplar> ExemplarReservoir::Snapshot() const {
+    std::vector<Exemplar> exemplars;
+
+    for (size_t i = 0; i <= boundaries_.size(); i++) {
+      const Slot& slot = slots_[i];
+
+      double value;
+      int64_t time_ns;
+      uint64_t trace_id[2];
+      uint64_t span_id;
+
+      // Retry until no writer got in the way
+      while (true) {
+        const uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        value = slot.value.load(std::memory_order_relaxed);
+        time_ns = slot.time_ns.load(std::memory_order_relaxed);
+        trace_id[0] = slot.trace_id_high.load(std::memory_order_relaxed);
+        trace_id[1] = slot.trace_id_low.load(std::memory_order_relaxed);
+        span_id = slot.span_id.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before) break;
+      }
+
+      if (time_ns == 0) continue;
+
+      Exemplar exemplar;
+      exemplar.lower_bound = i == 0 ? -std::numeric_limits<double>::infinity() : boundaries_[i - 1];
+      exemplar.upper_bound = i == boundaries_.size() ? std::numeric_limits<double>::infinity() : boundaries_[i];
+      exemplar.value = value;
+      exemplar.time = absl::FromUnixNanos(time_ns);
+      exemplar.trace_id = ToHex(trace_id, 2);
+      exemplar.span_id = ToHex(&span_id, 1);
+      exemplars.push_back(exemplar);
+    }
+
+    return exemplars;
+}
+
+void ExemplarReservoir::RegisterForExport(const std::string& view_name) {
+    bool first = false;
+    {
+      std::lock_guard<std::mutex> lock(registry_mu);
+      if (registry == nullptr) {
+        registry = new std::vector<std::pair<std::string, const ExemplarReservoir*>>();
+        first = true;
+      }
+      registry->push_back({view_name, this});
+    }
+
+    // Registered outside the lock, since the exporter calls the handler with its own lock held
+    if (first) {
+      opencensus::stats::StatsExporter::RegisterPushHandler(
+          std::unique_ptr<opencensus::stats::StatsExporter::Handler>(new ExemplarExportHandler()));
+    }
+}
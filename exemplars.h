@@ -0,0 +1,102 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef EXEMPLARS_H
+#define EXEMPLARS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "opencensus/trace/span_context.h"
+
+
+/*
+* Keeps one exemplar per bucket of a distribution view: the trace and span
+* of the slowest sample seen in the bucket recently, so that a latency
+* spike can be followed to the spans that caused it.
+*
+* Each bucket is a fixed slot guarded by a sequence counter, so Record()
+* takes O(1) time, never allocates and never blocks: a writer which finds
+* the slot busy simply drops its sample.
+*/
+class ExemplarReservoir {
+  public:
+    struct Exemplar {
+      // Bucket bounds, the lower one inclusive
+      double lower_bound;
+      double upper_bound;
+
+      double value;
+      absl::Time time;
+      std::string trace_id;
+      std::string span_id;
+    };
+
+    /*
+    * @param boundaries - The bucket boundaries of the view, in increasing order
+    * @param window - How long the slowest sample of a bucket is kept before
+    *                 any newer sample may replace it
+    */
+    explicit ExemplarReservoir(const std::vector<double>& boundaries,
+                               absl::Duration window = absl::Minutes(1));
+
+    /*
+    * Offers a sample to its bucket's slot.
+    *
+    * @param value - The recorded value
+    * @param context - The span the value was measured in
+    */
+    void Record(double value, const opencensus::trace::SpanContext& context);
+
+    /*
+    * @return exemplars - A consistent copy of every non-empty slot, by bucket
+    */
+    std::vector<Exemplar> Snapshot() const;
+
+    /*
+    * Dumps this reservoir under 'view_name' whenever the stats exporters
+    * export that view. Registers the dump handler on first use.
+    */
+    void RegisterForExport(const std::string& view_name);
+
+  private:
+    struct Slot {
+      // Odd while a writer is updating the slot
+      std::atomic<uint32_t> sequence;
+
+      std::atomic<double> value;
+      std::atomic<int64_t> time_ns;
+      std::atomic<uint64_t> trace_id_high;
+      std::atomic<uint64_t> trace_id_low;
+      std::atomic<uint64_t> span_id;
+    };
+
+    const std::vector<double> boundaries_;
+    const int64_t window_ns_;
+
+    // One slot per bucket, i.e. boundaries_.size() + 1 slots
+    std::unique_ptr<Slot[]> slots_;
+};
+
+
+#endif
@@ -17,6 +17,8 @@
 #include <cstdlib>
 #include <iostream>
 
+#include "diagnostics.h"
+
 #include "opencensus/exporters/stats/stackdriver/stackdriver_exporter.h"
 #include "opencensus/exporters/stats/stdout/stdout_exporter.h"
 #include "opencensus/exporters/trace/ocagent/ocagent_exporter.h"
@@ -56,4 +58,7 @@ void RegisterExporters() {
     opts.address = ocagent_address;
     opencensus::exporters::trace::OcAgentExporter::Register(std::move(opts));
   }
+
+  // Live spans, stats and profiles on a local port (DIAGNOSTICS_PORT).
+  StartDiagnosticsServer();
 }
\ No newline at end of file
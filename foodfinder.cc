@@ -24,6 +24,9 @@ using grpc::ClientContext;
 using grpc::CompletionQueue;
 using grpc::Status;
 
+using foodsystem::BasketItem;
+using foodsystem::BasketPlan;
+using foodsystem::BasketRequest;
 using foodsystem::SupplierList;
 using foodsystem::Ingredient;
 using foodsystem::FoodSystem;
@@ -36,10 +39,34 @@ using foodsystem::PriceRequest;
 /* ############################################################################ */
 
 opencensus::tags::TagKey status_key = opencensus::tags::TagKey::Register("Status");
+opencensus::tags::TagKey method_key = opencensus::tags::TagKey::Register("Method");
+opencensus::tags::TagKey vendor_key = opencensus::tags::TagKey::Register("Vendor");
+
+// Vendor names come from the FoodSupplier service, so bound how many of them
+// become tag values. Vendors seen only once are folded into "other".
+CardinalityLimiter vendor_tags(32, 2);
+
+/*
+* Log-linear bucket boundaries, as in HDR histograms: nine linear steps in
+* every power of ten from 10^min_exponent up to 10^max_exponent.
+*/
+std::vector<double> LogLinearBoundaries(int min_exponent, int max_exponent) {
+    std::vector<double> boundaries = {0};
+    for (int exponent = min_exponent; exponent < max_exponent; exponent++) {
+      for (int step = 1; step < 10; step++) {
+        boundaries.push_back(step * std::pow(10.0, exponent));
+      }
+    }
+    boundaries.push_back(std::pow(10.0, max_exponent));
+    return boundaries;
+}
 
 /* ---------------------------- RPC LATENCY METRIC ---------------------------- */
 ABSL_CONST_INIT const absl::string_view rpc_latency_measure_name = "rpc latency";
 
+// 1us to 10s, in ms
+const std::vector<double> rpc_latency_bucket_boundaries = LogLinearBoundaries(-3, 4);
+
 const opencensus::stats::MeasureDouble rpc_latency_measure = 
      opencensus::stats::MeasureDouble::Register(rpc_latency_measure_name , 
                                                 "Latency measure for rpc calls", 
@@ -49,11 +76,15 @@ const auto rpc_latency_view_descriptor = opencensus::stats::ViewDescriptor()
     .set_name("food_finder/rpc_latency")
     .set_measure(rpc_latency_measure_name)
     .set_aggregation(opencensus::stats::Aggregation::Distribution(
-                opencensus::stats::BucketBoundaries::Explicit(
-                    {0, 7.5, 15, 22.5, 30, 37.5, 45, 52.5, 60, 67.5})))
+                opencensus::stats::BucketBoundaries::Explicit(rpc_latency_bucket_boundaries)))
     .add_column(status_key)
+    .add_column(method_key)
+    .add_column(vendor_key)
     .set_description("Latency for the RPCs");
 
+// Trace and span of the slowest recent RPC in each latency bucket
+ExemplarReservoir rpc_latency_exemplars(rpc_latency_bucket_boundaries);
+
 /* ---------------------------- RPC ERRORS METRIC ----------------------------- */
 ABSL_CONST_INIT const absl::string_view rpc_errors_measure_name = "rpc errors count";
 
@@ -67,6 +98,8 @@ const auto rpc_errors_view_descriptor = opencensus::stats::ViewDescriptor()
     .set_measure(rpc_errors_measure_name)
     .set_aggregation(opencensus::stats::Aggregation::Count())
     .add_column(status_key)
+    .add_column(method_key)
+    .add_column(vendor_key)
     .set_description("Cumulative count of RPC errors");
 
 /* ---------------------------- RPC COUNT METRIC ------------------------------ */
@@ -82,6 +115,8 @@ const auto rpc_count_view_descriptor = opencensus::stats::ViewDescriptor()
     .set_measure(rpc_count_measure_name)
     .set_aggregation(opencensus::stats::Aggregation::Count())
     .add_column(status_key)
+    .add_column(method_key)
+    .add_column(vendor_key)
     .set_description("Cumulative count of RPCs");
 
 
@@ -108,6 +143,32 @@ const auto suppliers_per_query_view_descriptor = opencensus::stats::ViewDescript
 /* ############################################################################ */
 
 
+void RecordRpc(absl::string_view method, absl::string_view vendor, const Status& status,
+               double latency, const opencensus::trace::SpanContext& context){
+    const std::string vendor_tag = vendor.empty() ? "" : vendor_tags.Limit(vendor);
+    const absl::string_view status_tag = status.ok() ? "OK" : "Error";
+
+    opencensus::stats::Record({{rpc_count_measure, 1}},
+                              {{status_key, status_tag}, {method_key, method}, {vendor_key, vendor_tag}});
+    opencensus::stats::Record({{rpc_latency_measure, latency}},
+                              {{status_key, status_tag}, {method_key, method}, {vendor_key, vendor_tag}});
+    rpc_latency_exemplars.Record(latency, context);
+
+    if(!status.ok()){
+        opencensus::stats::Record({{rpc_errors_measure, 1}},
+                                  {{status_key, status_tag}, {method_key, method}, {vendor_key, vendor_tag}});
+    }
+}
+
+
+void SetPriority(ClientContext* context){
+    static const char* priority = getenv("FOODFINDER_PRIORITY");
+    if(priority != nullptr){
+        context->AddMetadata("x-priority", priority);
+    }
+}
+
+
 void AddDelay(opencensus::trace::Span* parent_span, opencensus::trace::AlwaysSampler* sampler, int delay){
     auto child_span = opencensus::trace::Span::StartSpan("Delay Span", parent_span, {sampler});
     child_span.AddAnnotation("delay");
@@ -117,44 +178,54 @@ void AddDelay(opencensus::trace::Span* parent_span, opencensus::trace::AlwaysSam
 
 
 std::vector<std::string> GetSuppliers(std::string& ingredient,
-                                      std::unique_ptr<FoodSystem::Stub>& stub){
+                                      std::unique_ptr<FoodSystem::Stub>& stub,
+                                      RetryPolicy& policy){
+    // Count the allocations made for this lookup (with --define alloc_tracking=1)
+    AllocationScope allocations("FoodFinder.GetSuppliers");
+
     // Set up the request to send to FoodSupplier service
     Ingredient request_fs;
     request_fs.set_name(ingredient);
 
     // This will fetch results from the FoodSupplier service
     SupplierList reply_fs;
-    
-    ClientContext context_fs;
 
-    // Get current time (used for measuring latency of rpc)
-    const absl::Time start = absl::Now();
+    // Send the RPC, retrying transient failures
+    const Status status = policy.Call([&]() {
+        // A context can only be used for a single RPC
+        ClientContext context_fs;
+        reply_fs.Clear();
 
-    // Send the RPC
-    const Status status = stub->GetSuppliers(&context_fs, request_fs, &reply_fs);
+        // Get current time (used for measuring latency of rpc)
+        const absl::Time start = absl::Now();
 
-    // Get current time (used for measuring latency of rpc)
-    const absl::Time end = absl::Now();
-    const double latency = absl::ToDoubleMilliseconds(end - start);
+        // Send the RPC
+        const Status attempt_status = stub->GetSuppliers(&context_fs, request_fs, &reply_fs);
 
-    // Record data for metrics
-    opencensus::stats::Record({{rpc_count_measure, 1}}, {{status_key, !status.ok() ? "Error" : "OK"}});
-    opencensus::stats::Record({{rpc_latency_measure, latency}}, {{status_key, !status.ok() ? "Error" : "OK"}});
-    opencensus::stats::Record({{suppliers_per_query_measure, reply_fs.items_size()}}, {{status_key, !status.ok() ? "Error" : "OK"}});
+        // Get current time (used for measuring latency of rpc)
+        const absl::Time end = absl::Now();
+        const double latency = absl::ToDoubleMilliseconds(end - start);
+
+        // Record data for metrics
+        RecordRpc("GetSuppliers", "", attempt_status, latency, opencensus::trace::GetCurrentSpan().context());
+        opencensus::stats::Record({{suppliers_per_query_measure, reply_fs.items_size()}}, {{status_key, !attempt_status.ok() ? "Error" : "OK"}});
+
+        return attempt_status;
+    });
 
     if(!status.ok()){
-        opencensus::stats::Record({{rpc_errors_measure, 1}});
-        std::cout << "Error while fetching suppliers" << std::endl;
+        OutputSink::Get().Error("Error while fetching suppliers");
         return {};
     }
 
     std::vector<std::string> suppliers;
 
-    std::cout << "SEARCH RESULTS FOR " << ingredient << "\n\n";
+    OutputSink::Get().Text(absl::StrCat("SEARCH RESULTS FOR ", ingredient, "\n"));
 
     // Check if we got any suppliers and accordingly populate 'suppliers' vector
     if(reply_fs.items_size() == 0) {
-        std::cout << "No suppliers have " << ingredient << std::endl << std::endl;
+        OutputSink::Get().Record("no_suppliers", {{"ingredient", ingredient}},
+                                 absl::StrCat("No suppliers have ", ingredient, "\n"));
     } else {
         for(const std::string& vendor: reply_fs.items()){
             suppliers.push_back(vendor);
@@ -169,129 +240,236 @@ void GetInfoFromVendors(const std::string& ingredient,
                         const std::vector<std::string>& vendors,
                         opencensus::trace::Span& parent_span,
                         opencensus::trace::AlwaysSampler& sampler,
-                        const std::unique_ptr<FoodSystem::Stub>& stub){
+                        const std::unique_ptr<FoodSystem::Stub>& stub,
+                        RetryPolicy& policy){
+    // Count the allocations made for this fan-out (with --define alloc_tracking=1)
+    AllocationScope allocations("FoodFinder.GetInfoFromVendors");
 
     // Declare the map which will hold the {key, value} pairs
     // of the form {vendor, price of the ingredeint}
     std::unordered_map<std::string, double> prices;
 
-    // Map to hold the PriceInfo object s
-    std::unordered_map<std::string, PriceInfo> price_infos;
-
-    // Map to hold the trace spans for each vendor's RPC
-    std::unordered_map<std::string, opencensus::trace::Span> spans;
-
     // The producer-consumer queue for asnchronous notifications
     CompletionQueue cq;
 
-    // A tag struct which contains the name of the vendor and the time when the rpc
-    // was made to that vendor the fetch price info
+    // A tag struct which holds everything about the rpcs sent to one vendor.
+    // It lives until the last attempt completes, since the runtime writes
+    // the reply and status into it.
     struct tag {
         std::string vendor;
+        PriceRequest request;
+        PriceInfo reply;
+        Status status;
+        std::unique_ptr<ClientContext> context;
+        std::unique_ptr<ClientAsyncResponseReader<PriceInfo>> rpc;
+
+        // Time when the current attempt was sent
         absl::Time start_time;
-        tag(std::string vendor, absl::Time start_time) : vendor(vendor), start_time(start_time) {}
-    };
 
-    // Get price info from each vendor
-    for(const std::string& vendor: vendors){
-        PriceRequest price_request;
-        PriceInfo price_info;
+        // Current attempt, starting at 0
+        int attempt;
 
-        // Get a reference to the PriceInfo object which will be populated by the server
-        // and later used to check the price in the client
-        price_infos[vendor] = price_info;        
+        // Circuit breaker permit of the current attempt
+        uint64_t permit;
 
-        // Set up request
-        price_request.set_vendor(vendor);
-        price_request.set_ingredient(ingredient);
+        // Fires on the completion queue once the backoff before a retry is over
+        grpc::Alarm backoff;
+        bool in_backoff;
 
-        Status status;
-        ClientContext context;        
+        // Span covering every attempt for this vendor
+        opencensus::trace::Span span;
 
-        // Create rpc object
-        std::unique_ptr<ClientAsyncResponseReader<PriceInfo>> rpc(stub->PrepareAsyncGetInfoFromVendor(&context, price_request, &cq));
+        tag(const std::string& vendor, opencensus::trace::Span span)
+            : vendor(vendor), attempt(0), permit(0), in_backoff(false), span(span) {}
+    };
 
-        // Begin the span for the current vendor
-        opencensus::trace::Span span = opencensus::trace::Span::StartSpan("Fetching price info from " + vendor, &parent_span, {&sampler});
-        span.AddAnnotation("Fetching price info from " + vendor);
+    // Sends the current attempt for a vendor, unless the circuit breaker is open
+    auto start_attempt = [&](tag* call) -> bool {
+        if(!policy.Allow(&call->permit)){
+            call->status = policy.BreakerOpenStatus();
+            return false;
+        }
 
-        // ERROR: This type of insertion is needed because the default 'Span()' constructor is a deleted function
-        //        and maps need a default constructor if 'map[key] = value' type insertion is wanted
-        // spans[vendor] = span;
+        // A context can only be used for a single RPC. The previous reader
+        // lives in the previous call's arena, which the context frees, so
+        // it must go first.
+        call->rpc.reset();
+        call->context.reset(new ClientContext());
+        SetPriority(call->context.get());
+        call->reply.Clear();
 
-        // Add to map using insert, which does not need a default constructor
-        spans.insert({{vendor, span}});
+        // Create rpc object
+        call->rpc = stub->PrepareAsyncGetInfoFromVendor(call->context.get(), call->request, &cq);
 
         // Start time
-        const absl::Time start_time = absl::Now();
+        call->start_time = absl::Now();
 
         // Initiate the rpc call
-        rpc->StartCall();
+        call->rpc->StartCall();
 
         // Request that, upon completion of the RPC, "reply" be updated with the
         // server's response; "status" with the indication of whether the operation
-        // was successful. Tag the request with the vendor's name.
-        // rpc->Finish(&price_infos[vendor], &status, static_cast<void*>(new std::string(vendor)));
-        rpc->Finish(&price_infos[vendor], &status, static_cast<void*>(new tag(vendor, start_time)));
+        // was successful. Tag the request with the vendor's call state.
+        call->rpc->Finish(&call->reply, &call->status, static_cast<void*>(call));
+        return true;
+    };
+
+    // Tags of the vendors we are waiting on
+    std::vector<std::unique_ptr<tag>> calls;
+    int counter = 0;
+
+    // Get price info from each vendor
+    for(const std::string& vendor: vendors){
+        // Begin the span for the current vendor
+        opencensus::trace::Span span = opencensus::trace::Span::StartSpan("Fetching price info from " + vendor, &parent_span, {&sampler});
+        span.AddAnnotation("Fetching price info from " + vendor);
+
+        std::unique_ptr<tag> call(new tag(vendor, span));
+
+        // Set up request
+        call->request.set_vendor(vendor);
+        call->request.set_ingredient(ingredient);
+
+        policy.RecordRequest();
+        if(start_attempt(call.get())){
+            counter++;
+        } else {
+            call->span.End();
+            prices[vendor] = 0;
+        }
+        calls.push_back(std::move(call));
     }
 
 
     void* got_tag;
     bool ok = false;
-    int counter = vendors.size();
 
     // Keep looping till we have not received response for all vendors
     // and then block till we get the next result in the completion queue
     while(counter && cq.Next(&got_tag, &ok)){
         // Get current tag
-        std::unique_ptr<tag> curr_tag((tag*)got_tag);
+        tag* curr_tag = static_cast<tag*>(got_tag);
 
         // Extract info from the current tag
         std::string& vendor = curr_tag->vendor;
+
+        // The backoff is over: send the retry
+        if(curr_tag->in_backoff){
+            curr_tag->in_backoff = false;
+            curr_tag->span.AddAnnotation(absl::StrCat("Retry attempt ", curr_tag->attempt));
+            if(!start_attempt(curr_tag)){
+                curr_tag->span.End();
+                counter--;
+                prices[vendor] = 0;
+            }
+            continue;
+        }
+
         absl::Time& start_time = curr_tag->start_time;
 
         // Measure latency for receiving info from this particular vendor
         const absl::Time end = absl::Now();
         double latency = absl::ToDoubleMilliseconds(end - start_time);
 
-        // Record data for metrics
-        opencensus::stats::Record({{rpc_count_measure, 1}}, {{status_key, ok ? "Error" : "OK"}});
-        opencensus::stats::Record({{rpc_latency_measure, latency}}, {{status_key, ok ? "Error" : "OK"}});
-
-        if(!ok){
-            opencensus::stats::Record({{rpc_errors_measure, 1}});
+        // Record data for metrics. "ok" only says the RPC completed: whether
+        // it succeeded is in its status.
+        RecordRpc("GetInfoFromVendor", vendor, curr_tag->status, latency, curr_tag->span.context());
+
+        // Retry transient failures after a backoff, without blocking the other vendors
+        policy.RecordResult(curr_tag->status, curr_tag->permit);
+        if(!curr_tag->status.ok() && policy.ShouldRetry(curr_tag->status, curr_tag->attempt)){
+            const absl::Duration backoff = policy.Backoff(curr_tag->attempt);
+            curr_tag->attempt++;
+            curr_tag->in_backoff = true;
+            curr_tag->backoff.Set(&cq, std::chrono::system_clock::now() + absl::ToChronoMicroseconds(backoff), got_tag);
+            continue;
         }
 
-        // Find the current vendor's corresponding span and end it
-        auto it = spans.find(vendor);
-        it->second.End();
-
-        // ERROR: The line of code below produces an error because the default constructor 
-        //        opencensus::trace::Span() has been marked as delete
-        // spans[*vendor].End();
+        // End the current vendor's span
+        curr_tag->span.End();
 
         // Decrement counter to keep track of how many vendors we have received price info for
         counter--;
 
         // Add to prices map for displaying results at the end
-        prices[vendor] = price_infos[vendor].price();
+        prices[vendor] = curr_tag->status.ok() ? curr_tag->reply.price() : 0;
     }
 
     cq.Shutdown();
+
+    // Drain the queue before the tags go away
+    while(cq.Next(&got_tag, &ok)){}
     
     // Print results
-    std::cout << "----------------------------\n";
-    std::cout << "Vendor\t|\tPrice\n";
-    std::cout << "----------------------------\n";
+    OutputSink& out = OutputSink::Get();
+    out.Text("----------------------------");
+    out.Text("Vendor\t|\tPrice");
+    out.Text("----------------------------");
     auto it = prices.begin();
     for(;it != prices.end(); it++){
         if(it->second)
-            std::cout << it->first << "\t|\t$" << it->second  << std::endl;
+            out.Record("price", {{"ingredient", ingredient}, {"vendor", it->first}, {"price", it->second}},
+                       absl::StrCat(it->first, "\t|\t$", it->second));
         else
-            std::cout << it->first << "\t|\t" << "Error" << std::endl;
+            out.Record("price_error", {{"ingredient", ingredient}, {"vendor", it->first}},
+                       absl::StrCat(it->first, "\t|\t", "Error"));
+    }
+
+    out.Text("");
+}
+
+
+void PlanBasket(const std::vector<std::string>& ingredients,
+                const std::unique_ptr<FoodSystem::Stub>& stub){
+    // Count the allocations made for this query (with --define alloc_tracking=1)
+    AllocationScope allocations("FoodFinder.PlanBasket");
+
+    BasketRequest request;
+    for(const std::string& ingredient: ingredients){
+        request.add_ingredients(ingredient);
+    }
+
+    BasketPlan plan;
+    ClientContext context;
+    SetPriority(&context);
+
+    // Get current time (used for measuring latency of rpc)
+    const absl::Time start = absl::Now();
+
+    // Send the RPC
+    const Status status = stub->PlanBasket(&context, request, &plan);
+
+    const double latency = absl::ToDoubleMilliseconds(absl::Now() - start);
+
+    // Record data for metrics
+    RecordRpc("PlanBasket", "", status, latency, opencensus::trace::GetCurrentSpan().context());
+
+    if(!status.ok()){
+        OutputSink::Get().Error("Error while planning basket");
+        return;
     }
 
-    std::cout << std::endl;
+    // Print results
+    OutputSink& out = OutputSink::Get();
+    out.Text("CHEAPEST BASKET\n");
+    out.Text("----------------------------");
+    out.Text("Ingredient\t|\tVendor\t|\tPrice");
+    out.Text("----------------------------");
+    for(const BasketItem& item: plan.cheapest_items()){
+        out.Record("basket_item", {{"ingredient", item.ingredient()}, {"vendor", item.vendor()}, {"price", item.price()}},
+                   absl::StrCat(item.ingredient(), "\t|\t", item.vendor(), "\t|\t$", item.price()));
+    }
+    for(const std::string& ingredient: plan.unavailable()){
+        out.Record("basket_unavailable", {{"ingredient", ingredient}},
+                   absl::StrCat(ingredient, "\t|\t", "Unavailable"));
+    }
+    out.Text("");
+
+    if(plan.single_vendor().empty())
+        out.Record("basket_single_vendor", {}, "No single vendor has every ingredient\n");
+    else
+        out.Record("basket_single_vendor", {{"vendor", plan.single_vendor()}, {"total", plan.single_vendor_total()}},
+                   absl::StrCat("Cheapest single vendor: ", plan.single_vendor(), " ($", plan.single_vendor_total(), ")\n"));
 }
 
 
@@ -300,29 +478,68 @@ void RungRPC() {
     grpc::RegisterOpenCensusPlugin();
     RegisterExporters();
 
+    // Create a channel to the FoodSupplier service to send RPCs over.
+    std::shared_ptr<grpc::Channel> foodsupplier_channel = grpc::CreateChannel("foodsupplier:9001", grpc::InsecureChannelCredentials());
+
+    // Create a channel to the FoodVendor service to send RPCs over.
+    std::shared_ptr<grpc::Channel> foodvendor_channel = grpc::CreateChannel("foodvendor:9002", grpc::InsecureChannelCredentials());	
+
+    RunFoodFinder(foodsupplier_channel, foodvendor_channel);
+}
+
+
+void RunFoodFinder(std::shared_ptr<grpc::Channel> foodsupplier_channel,
+                   std::shared_ptr<grpc::Channel> foodvendor_channel) {
     rpc_errors_view_descriptor.RegisterForExport();
     rpc_count_view_descriptor.RegisterForExport();
     rpc_latency_view_descriptor.RegisterForExport();
+    rpc_latency_exemplars.RegisterForExport(rpc_latency_view_descriptor.name());
     suppliers_per_query_view_descriptor.RegisterForExport();
+    RegisterRetryPolicyViewsForExport();
+    RegisterAllocationViewsForExport();
 
-    // Create a channel to the FoodSupplier service to send RPCs over.
-    std::shared_ptr<grpc::Channel> foodsupplier_channel = grpc::CreateChannel("foodsupplier:9001", grpc::InsecureChannelCredentials());
     std::unique_ptr<FoodSystem::Stub> foodsupplier_stub = FoodSystem::NewStub(foodsupplier_channel);
-
-    // Create a channel to the FoodVendor service to send RPCs over.
-    std::shared_ptr<grpc::Channel> foodvendor_channel = grpc::CreateChannel("foodvendor:9002", grpc::InsecureChannelCredentials());	
     std::unique_ptr<FoodSystem::Stub> foodvendor_stub = FoodSystem::NewStub(foodvendor_channel);
 
+    // Retry budgets and circuit breakers, one per endpoint
+    RetryPolicy foodsupplier_policy("foodsupplier");
+    RetryPolicy foodvendor_policy("foodvendor");
+
     // Setup Always sampler so that every span is processed and exported
     static opencensus::trace::AlwaysSampler sampler;	
 
     while(true){
         // Get user specified ingredient
         std::string ingredient;
-        std::cout << "Please enter your ingredient (press x to quit):" << std::endl;
+        OutputSink::Get().Text("Please enter your ingredient, or a comma separated basket (press x to quit):");
+
+        // Let the previous results reach the terminal before waiting on input
+        OutputSink::Get().Flush();
         std::getline(std::cin, ingredient);
         if(ingredient == "x") break;
 
+        // A basket is planned on the FoodVendor service in a single RPC
+        if(ingredient.find(',') != std::string::npos){
+            std::vector<std::string> basket;
+            for(absl::string_view item: absl::StrSplit(ingredient, ',', absl::SkipWhitespace())){
+                basket.push_back(std::string(absl::StripAsciiWhitespace(item)));
+            }
+            if(basket.empty()){
+                OutputSink::Get().Error("Please enter at least one ingredient");
+                continue;
+            }
+
+            auto basket_span = opencensus::trace::Span::StartSpan("Planning basket", nullptr, {&sampler});
+            basket_span.AddAnnotation("Sending basket to FoodVendor service.");
+            {
+                // Make the span current so that latency exemplars point at it
+                opencensus::trace::WithSpan with_span(basket_span);
+                PlanBasket(basket, foodvendor_stub);
+            }
+            basket_span.End();
+            continue;
+        }
+
 
         // This is a parent span which spans both RPCs sent to FoodSupplier and FoodVendor services 
         auto system_span = opencensus::trace::Span::StartSpan("System span", nullptr, {&sampler});
@@ -337,7 +554,12 @@ void RungRPC() {
         AddDelay(&fs_span, &sampler, (rand() % 20) + 1);
 
         // Get list of potential suppliers
-        std::vector<std::string> suppliers = GetSuppliers(ingredient, foodsupplier_stub);
+        std::vector<std::string> suppliers;
+        {
+            // Make the span current so that latency exemplars point at it
+            opencensus::trace::WithSpan with_span(fs_span);
+            suppliers = GetSuppliers(ingredient, foodsupplier_stub, foodsupplier_policy);
+        }
         
         // End the current span
         fs_span.End();
@@ -353,7 +575,7 @@ void RungRPC() {
 
         // Fetch inventory info from vendors
         if(suppliers.size())
-            GetInfoFromVendors(ingredient, suppliers, fv_span, sampler, foodvendor_stub);        
+            GetInfoFromVendors(ingredient, suppliers, fv_span, sampler, foodvendor_stub, foodvendor_policy);        
 
         // End the current span
         fv_span.End();
@@ -367,13 +589,8 @@ void RungRPC() {
         {128, 128, 128, 128, opencensus::trace::ProbabilitySampler(0.0)});
 
     // Sleep while exporters run in the background.
-    std::cout << "Client sleeping, ^C to exit.\n";
+    OutputSink::Get().Text("Client sleeping, ^C to exit.");
     while (true) {
         absl::SleepFor(absl::Seconds(7));
     }
 }
-
-int main(int argc, char** argv) {
-    RungRPC();
-    return 0;
-}
@@ -19,6 +19,8 @@
 #ifndef FOOD_FINDER_H
 #define FOOD_FINDER_H
 
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -26,14 +28,24 @@
 #include <thread>
 
 #include <grpc++/grpc++.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/opencensus.h>
 
 #include "foodsystem.grpc.pb.h"
 
+#include "alloc_tracker.h"
+#include "cardinality_limiter.h"
+#include "exemplars.h"
 #include "exporters.h"
+#include "output_sink.h"
+#include "retry_policy.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/ascii.h"
 #include "absl/time/clock.h"
+#include "opencensus/trace/context_util.h"
 #include "opencensus/trace/trace_config.h"
+#include "opencensus/trace/with_span.h"
 #include "opencensus/trace/sampler.h"
 #include "opencensus/stats/aggregation.h"
 #include "opencensus/stats/bucket_boundaries.h"
@@ -46,6 +58,30 @@
 /* ############################ HELPER FUNCTIONS ############################## */
 /* ############################################################################ */
 
+/*
+* Records the count, latency and errors metrics of one RPC attempt, tagged
+* by status, method and vendor.
+*
+* @param method - The RPC method
+* @param vendor - The vendor called, or empty if the RPC is not about one vendor
+* @param status - The status the attempt ended with
+* @param latency - The latency of the attempt, in ms
+* @param context - The span the attempt ran in, kept as an exemplar
+*/
+void RecordRpc(absl::string_view method, absl::string_view vendor, const grpc::Status& status,
+               double latency, const opencensus::trace::SpanContext& context);
+
+
+/*
+* Sets the priority class FoodVendor serves a request with, from the
+* FOODFINDER_PRIORITY environment variable ("interactive", the default,
+* or "bulk").
+*
+* @param context - The context of the request
+*/
+void SetPriority(grpc::ClientContext* context);
+
+
 /*
 * Adds synthetic delays to better simulate processing time
 * and view more descriptive traces on GCP.
@@ -62,10 +98,12 @@ void AddDelay(opencensus::trace::Span* parent_span, opencensus::trace::AlwaysSam
 *
 * @param ingredient - The user specified ingredient 
 * @param stub - The FoodSystem stub used to send RPCs
+* @param policy - Retry policy for the FoodSupplier service
 * @return suppliers - The list of suppliers who have the user specified ingredient
 */
 std::vector<std::string> GetSuppliers(std::string& ingredient,
-                                      std::unique_ptr<foodsystem::FoodSystem::Stub>& stub);
+                                      std::unique_ptr<foodsystem::FoodSystem::Stub>& stub,
+                                      RetryPolicy& policy);
 
 
 /*
@@ -76,12 +114,25 @@ std::vector<std::string> GetSuppliers(std::string& ingredient,
 * @param vendors - List of vendors who have the user specified ingredient
 * @param parent_span - The span of which we create child spans for each RPC
 * @param stub - FoodSystem stub used to send RPCs to FoodVendor service
+* @param policy - Retry policy for the FoodVendor service, applied to each vendor's RPC
 */
-void GetInfoFromVendor(const std::string& ingredient,
-                       const std::vector<std::string>& vendors,
-                       opencensus::trace::Span& parent_span,
-                       opencensus::trace::AlwaysSampler& sampler,
-                       std::unique_ptr<foodsystem::FoodSystem::Stub>& stub);
+void GetInfoFromVendors(const std::string& ingredient,
+                        const std::vector<std::string>& vendors,
+                        opencensus::trace::Span& parent_span,
+                        opencensus::trace::AlwaysSampler& sampler,
+                        const std::unique_ptr<foodsystem::FoodSystem::Stub>& stub,
+                        RetryPolicy& policy);
+
+
+/*
+* Fetches, in a single RPC to the FoodVendor service, the cheapest vendor for
+* each ingredient of a basket and the cheapest vendor selling all of them.
+*
+* @param ingredients - The user specified ingredients
+* @param stub - FoodSystem stub used to send RPCs to FoodVendor service
+*/
+void PlanBasket(const std::vector<std::string>& ingredients,
+                const std::unique_ptr<foodsystem::FoodSystem::Stub>& stub);
 
 
 /*
@@ -90,4 +141,16 @@ void GetInfoFromVendor(const std::string& ingredient,
 void RungRPC();
 
 
+/*
+* Runs the interactive query loop against the given FoodSupplier and
+* FoodVendor channels. Expects the OpenCensus plugin and exporters to
+* be registered already.
+*
+* @param foodsupplier_channel - Channel to the FoodSupplier service
+* @param foodvendor_channel - Channel to the FoodVendor service
+*/
+void RunFoodFinder(std::shared_ptr<grpc::Channel> foodsupplier_channel,
+                   std::shared_ptr<grpc::Channel> foodvendor_channel);
+
+
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 grpc::Status FoodSupplier::GetSuppliers(grpc::ServerContext* context,
                         const foodsystem::Ingredient* request,
                         foodsystem::SupplierList* reply) {
+    AllocationScope allocations("FoodSupplier.GetSuppliers");
 
     // Fetch the suppliers which have the user-specified ingredient
     auto it = suppliers.begin();
@@ -26,6 +27,9 @@ grpc::Status FoodSupplier::GetSuppliers(grpc::ServerContext* context,
 
 
 void RunServer() {
+  // SIGTERM is handled by the drain thread below
+  BlockShutdownSignals();
+
   // The server address of the form "address:port"
   std::string server_address("0.0.0.0:9001");
   FoodSupplier service;
@@ -34,17 +38,21 @@ void RunServer() {
   grpc::RegisterOpenCensusPlugin();
 
   RegisterExporters();
+  RegisterAllocationViewsForExport();
 
   grpc::ServerBuilder builder;
   builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
   builder.RegisterService(&service);
+  ShareListeningPorts(&builder);
   std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
   std::cout << "Server listening on " << server_address << std::endl;
-  
-  server->Wait();
-}
 
-int main(int argc, char** argv) {
-  RunServer();
-  return 0;
+  // On SIGTERM, stop accepting RPCs and let the ones in flight finish
+  std::thread drain([&server] {
+    WaitForShutdownSignal();
+    server->Shutdown(std::chrono::system_clock::now() + absl::ToChronoMilliseconds(ShutdownGracePeriod()));
+  });
+
+  server->Wait();
+  drain.join();
 }
@@ -5,12 +5,15 @@
 #include <unordered_map>
 #include <memory>
 #include <string>
+#include <thread>
 
 #include <grpc++/grpc++.h>
 #include <grpcpp/opencensus.h>
 
+#include "alloc_tracker.h"
 #include "exporters.h"
 #include "foodsystem.grpc.pb.h"
+#include "supervisor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/time/clock.h"
 #include "opencensus/trace/trace_config.h"
@@ -50,7 +53,7 @@ private:
 };
 
 /*
-* Runs the gRPC Server
+* Runs the gRPC Server until SIGTERM, then drains it
 */
 void RunServer();
 
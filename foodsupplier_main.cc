@@ -0,0 +1,5 @@
+#include "foodsupplier.h"
+
+int main(int argc, char** argv) {
+  return RunWorkers(RunServer);
+}
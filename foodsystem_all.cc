@@ -0,0 +1,81 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "foodfinder.h"
+#include "foodsupplier.h"
+#include "foodvendor.h"
+
+/*
+* Runs the FoodSupplier service, the FoodVendor service and the FoodFinder
+* client in a single process. The client talks to both services through
+* in-process channels, which keep serialization but skip the network stack,
+* or through Unix domain sockets when FOODSYSTEM_SOCKET_DIR is set.
+*/
+int main(int argc, char** argv) {
+  // Register the OpenCensus gRPC plugin to enable stats and tracing in gRPC.
+  grpc::RegisterOpenCensusPlugin();
+  RegisterExporters();
+
+  std::string foodsupplier_address;
+  std::string foodvendor_address;
+  const char* socket_dir = getenv("FOODSYSTEM_SOCKET_DIR");
+  if (socket_dir != nullptr) {
+    foodsupplier_address = absl::StrCat("unix:", socket_dir, "/foodsupplier.sock");
+    foodvendor_address = absl::StrCat("unix:", socket_dir, "/foodvendor.sock");
+
+    // Remove sockets left behind by a previous run
+    unlink(absl::StrCat(socket_dir, "/foodsupplier.sock").c_str());
+    unlink(absl::StrCat(socket_dir, "/foodvendor.sock").c_str());
+  }
+
+  // The FoodSupplier service is synchronous, so it gets a server of its own
+  FoodSupplier supplier_service;
+  grpc::ServerBuilder builder;
+  if (!foodsupplier_address.empty()) {
+    builder.AddListeningPort(foodsupplier_address, grpc::InsecureServerCredentials());
+  }
+  builder.RegisterService(&supplier_service);
+  std::unique_ptr<grpc::Server> supplier_server(builder.BuildAndStart());
+
+  // The FoodVendor service is served from its completion queue on a thread of its own
+  ServerImpl vendor_server;
+  vendor_server.Start(foodvendor_address);
+  std::thread vendor_thread([&vendor_server]() { vendor_server.HandleRpcs(); });
+  vendor_thread.detach();
+
+  std::shared_ptr<grpc::Channel> foodsupplier_channel;
+  std::shared_ptr<grpc::Channel> foodvendor_channel;
+  if (socket_dir != nullptr) {
+    std::cout << "Serving over Unix domain sockets in " << socket_dir << std::endl;
+    foodsupplier_channel = grpc::CreateChannel(foodsupplier_address, grpc::InsecureChannelCredentials());
+    foodvendor_channel = grpc::CreateChannel(foodvendor_address, grpc::InsecureChannelCredentials());
+  } else {
+    std::cout << "Serving over in-process channels" << std::endl;
+    foodsupplier_channel = supplier_server->InProcessChannel(grpc::ChannelArguments());
+    foodvendor_channel = vendor_server.InProcessChannel();
+  }
+
+  RunFoodFinder(foodsupplier_channel, foodvendor_channel);
+  return 0;
+}
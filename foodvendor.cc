@@ -18,6 +18,196 @@
 
 #include "foodvendor.h"
 
+#include "diagnostics.h"
+#include "supervisor.h"
+#include "opencensus/stats/stats.h"
+#include "opencensus/tags/tag_key.h"
+
+
+/* ############################################################################ */
+/* ################################# METRICS ################################## */
+/* ############################################################################ */
+
+opencensus::tags::TagKey priority_key = opencensus::tags::TagKey::Register("Priority");
+opencensus::tags::TagKey request_method_key = opencensus::tags::TagKey::Register("Method");
+
+const char* const priority_names[] = {"interactive", "bulk"};
+
+const std::vector<double> request_latency_bucket_boundaries = {0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+
+/* ---------------------------- QUEUE DEPTH METRIC ---------------------------- */
+ABSL_CONST_INIT const absl::string_view queue_depth_measure_name = "queue depth";
+
+const opencensus::stats::MeasureInt64 queue_depth_measure =
+     opencensus::stats::MeasureInt64::Register(queue_depth_measure_name,
+                                                "Matched requests waiting to be served",
+                                                "requests");
+
+const auto queue_depth_view_descriptor = opencensus::stats::ViewDescriptor()
+    .set_name("food_vendor/queue_depth")
+    .set_measure(queue_depth_measure_name)
+    .set_aggregation(opencensus::stats::Aggregation::LastValue())
+    .add_column(priority_key)
+    .set_description("Requests waiting to be served, by priority class");
+
+/* ----------------------------- QUEUE WAIT METRIC ---------------------------- */
+ABSL_CONST_INIT const absl::string_view queue_wait_measure_name = "queue wait";
+
+const opencensus::stats::MeasureDouble queue_wait_measure =
+     opencensus::stats::MeasureDouble::Register(queue_wait_measure_name,
+                                                "Time from matching a request to serving it",
+                                                "ms");
+
+const auto queue_wait_view_descriptor = opencensus::stats::ViewDescriptor()
+    .set_name("food_vendor/queue_wait")
+    .set_measure(queue_wait_measure_name)
+    .set_aggregation(opencensus::stats::Aggregation::Distribution(
+                opencensus::stats::BucketBoundaries::Explicit(request_latency_bucket_boundaries)))
+    .add_column(priority_key)
+    .add_column(request_method_key)
+    .set_description("Time requests wait to be served, by priority class");
+
+/* --------------------------- REQUEST LATENCY METRIC -------------------------- */
+ABSL_CONST_INIT const absl::string_view request_latency_measure_name = "request latency";
+
+const opencensus::stats::MeasureDouble request_latency_measure =
+     opencensus::stats::MeasureDouble::Register(request_latency_measure_name,
+                                                "Time from matching a request to sending its reply",
+                                                "ms");
+
+const auto request_latency_view_descriptor = opencensus::stats::ViewDescriptor()
+    .set_name("food_vendor/request_latency")
+    .set_measure(request_latency_measure_name)
+    .set_aggregation(opencensus::stats::Aggregation::Distribution(
+                opencensus::stats::BucketBoundaries::Explicit(request_latency_bucket_boundaries)))
+    .add_column(priority_key)
+    .add_column(request_method_key)
+    .set_description("Latency of requests, queueing included, by priority class");
+
+
+PriceBook::PriceBook() {
+    for (const auto& vendor : inventory_) {
+      const size_t id = VendorId(vendor.first);
+      for (const auto& item : vendor.second) {
+        offers_[item.first].push_back({id, item.second});
+      }
+    }
+}
+
+double PriceBook::GetPrice(const std::string& vendor, const std::string& ingredient) const {
+    auto vendor_it = inventory_.find(vendor);
+    if (vendor_it == inventory_.end()) return 0;
+    auto item_it = vendor_it->second.find(ingredient);
+    return item_it == vendor_it->second.end() ? 0 : item_it->second;
+}
+
+void PriceBook::SetPrice(const std::string& vendor, const std::string& ingredient, double price) {
+    inventory_[vendor][ingredient] = price;
+
+    // Keep the per-ingredient index in sync
+    const size_t id = VendorId(vendor);
+    std::vector<Offer>& offers = offers_[ingredient];
+    auto offer_it = std::find_if(offers.begin(), offers.end(),
+                                 [id](const Offer& offer) { return offer.vendor == id; });
+    if (offer_it == offers.end()) {
+      offers.push_back({id, price});
+    } else {
+      offer_it->price = price;
+    }
+
+    auto it = listeners_.find(Key(vendor, ingredient));
+    if (it == listeners_.end()) return;
+
+    PriceUpdate update;
+    update.set_vendor(vendor);
+    update.set_ingredient(ingredient);
+    update.set_price(price);
+
+    // Copy the set since a listener may unsubscribe while being notified
+    std::vector<PriceListener*> listeners(it->second.begin(), it->second.end());
+    for (PriceListener* listener : listeners) {
+      listener->OnPriceChange(update);
+    }
+}
+
+void PriceBook::Subscribe(const std::string& vendor, const std::string& ingredient, PriceListener* listener) {
+    listeners_[Key(vendor, ingredient)].insert(listener);
+}
+
+void PriceBook::Unsubscribe(const std::string& vendor, const std::string& ingredient, PriceListener* listener) {
+    auto it = listeners_.find(Key(vendor, ingredient));
+    if (it == listeners_.end()) return;
+    it->second.erase(listener);
+    if (it->second.empty()) listeners_.erase(it);
+}
+
+bool PriceBook::PlanBasket(const BasketRequest& request, BasketPlan* plan) const {
+    // Look up the offers for each distinct ingredient once
+    std::unordered_set<std::string> distinct;
+    std::vector<const std::string*> ingredients;
+    std::vector<const std::vector<Offer>*> offers;
+    for (const std::string& ingredient : request.ingredients()) {
+      if (ingredient.empty() || !distinct.insert(ingredient).second) continue;
+
+      auto it = offers_.find(ingredient);
+      if (it == offers_.end() || it->second.empty()) {
+        plan->add_unavailable(ingredient);
+        continue;
+      }
+      ingredients.push_back(&it->first);
+      offers.push_back(&it->second);
+    }
+
+    // Otherwise every vendor would trivially cover the basket
+    if (distinct.empty()) return false;
+
+    // Find the cheapest offer of each ingredient, and add every offer to its
+    // vendor's basket total and coverage count.
+    const size_t num_vendors = vendor_names_.size();
+    std::vector<double> totals(num_vendors, 0);
+    std::vector<size_t> covered(num_vendors, 0);
+    for (size_t i = 0; i < offers.size(); i++) {
+      const std::vector<Offer>& ingredient_offers = *offers[i];
+      size_t best = 0;
+      for (size_t j = 0; j < ingredient_offers.size(); j++) {
+        const Offer& offer = ingredient_offers[j];
+        if (offer.price < ingredient_offers[best].price) best = j;
+        totals[offer.vendor] += offer.price;
+        covered[offer.vendor]++;
+      }
+
+      const Offer& cheapest = ingredient_offers[best];
+      foodsystem::BasketItem* item = plan->add_cheapest_items();
+      item->set_ingredient(*ingredients[i]);
+      item->set_vendor(vendor_names_[cheapest.vendor]);
+      item->set_price(cheapest.price);
+    }
+
+    // A single vendor basket needs every distinct ingredient from the same vendor
+    for (size_t v = 0; v < num_vendors; v++) {
+      if (covered[v] != distinct.size()) continue;
+      if (plan->single_vendor().empty() || totals[v] < plan->single_vendor_total()) {
+        plan->set_single_vendor(vendor_names_[v]);
+        plan->set_single_vendor_total(totals[v]);
+      }
+    }
+    return true;
+}
+
+size_t PriceBook::VendorId(const std::string& vendor) {
+    auto it = vendor_ids_.find(vendor);
+    if (it != vendor_ids_.end()) return it->second;
+
+    vendor_names_.push_back(vendor);
+    vendor_ids_[vendor] = vendor_names_.size() - 1;
+    return vendor_names_.size() - 1;
+}
+
+std::string PriceBook::Key(const std::string& vendor, const std::string& ingredient) {
+    return absl::StrCat(vendor, "/", ingredient);
+}
+
+
 
 ServerImpl::~ServerImpl() {
     server_->Shutdown();
@@ -26,13 +216,20 @@ ServerImpl::~ServerImpl() {
 }
 
 
-void ServerImpl::Run() {
-    std::string server_address("0.0.0.0:9002");
+std::atomic<int64_t> ServerImpl::Tag::outstanding{0};
+std::atomic<int64_t> ServerImpl::events_{0};
+
 
+void ServerImpl::Start(const std::string& server_address) {
     ServerBuilder builder;
 
     // Listen on the given address without any authentication mechanism.
-    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    // Without an address the server is only reachable in-process.
+    if (!server_address.empty()) {
+      builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
+    }
+
+    ShareListeningPorts(&builder);
 
     // Register "service_" as the instance through which we'll communicate with
     // clients. In this case it corresponds to an *asynchronous* service.
@@ -45,20 +242,128 @@ void ServerImpl::Run() {
     // Finally assemble the server.
     server_ = builder.BuildAndStart();
 
-    std::cout << "Server listening on " << server_address << std::endl;
+    if (!server_address.empty()) {
+      std::cout << "Server listening on " << server_address << std::endl;
+    }
+
+    // Start the simulated price feed, if PRICE_TICK_MS is set. Off by default
+    // so that prices stay at the catalog values.
+    int tick_ms = 0;
+    const char* tick_env = getenv("PRICE_TICK_MS");
+    if (tick_env != nullptr) tick_ms = atoi(tick_env);
+    if (tick_ms > 0) {
+      ticker_.reset(new PriceTicker(cq_.get(), &prices_, absl::Milliseconds(tick_ms)));
+    }
+
+    queue_depth_view_descriptor.RegisterForExport();
+    queue_wait_view_descriptor.RegisterForExport();
+    request_latency_view_descriptor.RegisterForExport();
+    RegisterAllocationViewsForExport();
+
+    // Expose the completion queue on the diagnostics endpoint
+    RegisterDiagnosticsGauge("foodvendor_cq_outstanding_tags", [] { return Tag::outstanding.load(); });
+    RegisterDiagnosticsGauge("foodvendor_cq_events", [] { return events_.load(); });
+}
+
+
+void ServerImpl::Shutdown(absl::Duration grace) {
+    {
+      std::lock_guard<std::mutex> lock(shutdown_mu_);
+      shutting_down_ = true;
+    }
+    if (ticker_ != nullptr) ticker_->Stop();
+
+    // Requests not matched yet fail right away, and pending RPCs keep being
+    // served from HandleRpcs() until they finish or the deadline cancels them.
+    server_->Shutdown(std::chrono::system_clock::now() + absl::ToChronoMilliseconds(grace));
+
+    // Always shutdown the completion queue after the server.
+    cq_->Shutdown();
+}
+
+
+std::shared_ptr<grpc::Channel> ServerImpl::InProcessChannel() {
+    return server_->InProcessChannel(grpc::ChannelArguments());
+}
+
+
+const int ServerImpl::Scheduler::kWeights[NUM_PRIORITIES] = {8, 1};
+
+ServerImpl::Scheduler::Scheduler() {
+    std::copy(kWeights, kWeights + NUM_PRIORITIES, credits_);
+}
+
+ServerImpl::Priority ServerImpl::Scheduler::Classify(const ServerContext& ctx) {
+    const auto& metadata = ctx.client_metadata();
+    auto it = metadata.find("x-priority");
+    if (it != metadata.end() && it->second == "bulk") return BULK;
+    return INTERACTIVE;
+}
+
+void ServerImpl::Scheduler::Push(Job* job, Priority priority, const char* method) {
+    queues_[priority].push_back({job, method, absl::Now()});
+    RecordDepth(priority);
+}
+
+bool ServerImpl::Scheduler::Empty() const {
+    for (const auto& queue : queues_) {
+      if (!queue.empty()) return false;
+    }
+    return true;
+}
+
+void ServerImpl::Scheduler::ServeNext() {
+    // Take from the most urgent class with requests and credits left. Once
+    // no waiting class has credits left, start a new round.
+    int priority = -1;
+    for (int round = 0; round < 2 && priority < 0; round++) {
+      for (int p = 0; p < NUM_PRIORITIES; p++) {
+        if (!queues_[p].empty() && credits_[p] > 0) {
+          priority = p;
+          break;
+        }
+      }
+      if (priority < 0) std::copy(kWeights, kWeights + NUM_PRIORITIES, credits_);
+    }
+    if (priority < 0) return;
+
+    credits_[priority]--;
+    const Entry entry = queues_[priority].front();
+    queues_[priority].pop_front();
+    RecordDepth(static_cast<Priority>(priority));
+
+    const absl::Time start = absl::Now();
+    entry.job->Serve();
+    const absl::Time end = absl::Now();
+
+    opencensus::stats::Record({{queue_wait_measure, absl::ToDoubleMilliseconds(start - entry.enqueued)}},
+                              {{priority_key, priority_names[priority]}, {request_method_key, entry.method}});
+    opencensus::stats::Record({{request_latency_measure, absl::ToDoubleMilliseconds(end - entry.enqueued)}},
+                              {{priority_key, priority_names[priority]}, {request_method_key, entry.method}});
+}
+
+void ServerImpl::Scheduler::Clear() {
+    for (int p = 0; p < NUM_PRIORITIES; p++) {
+      for (const Entry& entry : queues_[p]) delete entry.job;
+      queues_[p].clear();
+      RecordDepth(static_cast<Priority>(p));
+    }
+}
 
-    // Proceed to the server's main loop.
-    HandleRpcs();
+void ServerImpl::Scheduler::RecordDepth(Priority priority) const {
+    opencensus::stats::Record({{queue_depth_measure, static_cast<int64_t>(queues_[priority].size())}},
+                              {{priority_key, priority_names[priority]}});
 }
 
 
-ServerImpl::CallData::CallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq)
-          : service_(service), cq_(cq), responder_(&ctx_), status_(CREATE) {
+ServerImpl::CallData::CallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq, PriceBook* prices,
+                               Scheduler* scheduler)
+          : prices_(prices), scheduler_(scheduler), service_(service), cq_(cq), responder_(&ctx_), status_(CREATE) {
     // Invoke the serving logic right away.
-    Proceed();
+    Proceed(true);
 }
 
-void ServerImpl::CallData::Proceed() {
+void ServerImpl::CallData::Proceed(bool ok) {
     if (status_ == CREATE) {
       // Make this instance progress to the PROCESS state.
       status_ = PROCESS;
@@ -69,52 +374,282 @@ void ServerImpl::CallData::Proceed() {
                                 this);
 
     } else if (status_ == PROCESS) {
+      // The server is shutting down and no request was matched.
+      if (!ok) {
+        delete this;
+        return;
+      }
+
       // Spawn a new CallData instance to serve new clients while we process
       // the one for this CallData. The instance will deallocate itself as
       // part of its FINISH state.
-      new CallData(service_, cq_);
+      new CallData(service_, cq_, prices_, scheduler_);
+
+      // Wait for our turn: Serve() is called by the scheduler.
+      scheduler_->Push(this, Scheduler::Classify(ctx_), "GetInfoFromVendor");
+
+    } else {
+      GPR_ASSERT(status_ == FINISH);
+      // Once in the FINISH state, deallocate ourselves (CallData).
+      delete this;
+    }
+};
 
-      // The actual processing: Fetch the price of the ingredient from
-      // the vendor
-      reply_.set_price(inventory[request_.vendor()][request_.ingredient()]);
+void ServerImpl::CallData::Serve() {
+    AllocationScope allocations("FoodVendor.GetInfoFromVendor");
 
-      // Sleep for a random period of time
-      absl::SleepFor(absl::Milliseconds((rand() % 20) + 1));
+    // The actual processing: Fetch the price of the ingredient from
+    // the vendor
+    reply_.set_price(prices_->GetPrice(request_.vendor(), request_.ingredient()));
 
+    // Sleep for a random period of time
+    absl::SleepFor(absl::Milliseconds((rand() % 20) + 1));
 
-      // Let the gRPC runtime know we've finished, using the
-      // memory address of this instance as the uniquely identifying tag for
-      // the event.
-      status_ = FINISH;
-      responder_.Finish(reply_, (rand() % 10) + 1 >= 2 ? Status::OK : Status::CANCELLED, this);
+
+    // Let the gRPC runtime know we've finished, using the
+    // memory address of this instance as the uniquely identifying tag for
+    // the event.
+    status_ = FINISH;
+    responder_.Finish(reply_, (rand() % 10) + 1 >= 2 ? Status::OK : Status::CANCELLED, this);
+}
 
 
+ServerImpl::BasketCallData::BasketCallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq, PriceBook* prices,
+                                           Scheduler* scheduler)
+          : prices_(prices), scheduler_(scheduler), service_(service), cq_(cq), responder_(&ctx_), status_(CREATE) {
+    // Invoke the serving logic right away.
+    Proceed(true);
+}
+
+void ServerImpl::BasketCallData::Proceed(bool ok) {
+    if (status_ == CREATE) {
+      status_ = PROCESS;
+      service_->RequestPlanBasket(&ctx_, &request_, &responder_, cq_, cq_, this);
+
+    } else if (status_ == PROCESS) {
+      // The server is shutting down and no request was matched.
+      if (!ok) {
+        delete this;
+        return;
+      }
+
+      // Keep a BasketCallData instance waiting for the next request.
+      new BasketCallData(service_, cq_, prices_, scheduler_);
+
+      scheduler_->Push(this, Scheduler::Classify(ctx_), "PlanBasket");
+
     } else {
       GPR_ASSERT(status_ == FINISH);
-      // Once in the FINISH state, deallocate ourselves (CallData).
       delete this;
     }
-};
+}
+
+void ServerImpl::BasketCallData::Serve() {
+    AllocationScope allocations("FoodVendor.PlanBasket");
+
+    status_ = FINISH;
+    if (!prices_->PlanBasket(request_, &reply_)) {
+      responder_.FinishWithError(Status(grpc::StatusCode::INVALID_ARGUMENT, "The basket has no ingredients"), this);
+      return;
+    }
+    responder_.Finish(reply_, Status::OK, this);
+}
+
+
+ServerImpl::WatchCallData::WatchCallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq, PriceBook* prices)
+          : prices_(prices), service_(service), cq_(cq), writer_(&ctx_), done_tag_(this),
+            writing_(false), done_(false), finished_(false), status_(CREATE) {
+    // Invoke the serving logic right away.
+    Proceed(true);
+}
+
+void ServerImpl::WatchCallData::Proceed(bool ok) {
+    if (status_ == CREATE) {
+      status_ = PROCESS;
+
+      // Ask to be told when the stream ends, so that subscribers which go
+      // away are dropped even if none of their keys ever changes again.
+      ctx_.AsyncNotifyWhenDone(&done_tag_);
+      service_->RequestWatchPrices(&ctx_, &request_, &writer_, cq_, cq_, static_cast<Tag*>(this));
+
+    } else if (status_ == PROCESS) {
+      // The server is shutting down and no request was matched. The done tag
+      // is only delivered for calls that started.
+      if (!ok) {
+        delete this;
+        return;
+      }
+
+      // Keep a WatchCallData instance waiting for the next subscriber.
+      new WatchCallData(service_, cq_, prices_);
+
+      status_ = STREAM;
+
+      // Subscribe, and start the stream with the current price of every key.
+      for (const PriceRequest& key : request_.keys()) {
+        prices_->Subscribe(key.vendor(), key.ingredient(), this);
+
+        PriceUpdate update;
+        update.set_vendor(key.vendor());
+        update.set_ingredient(key.ingredient());
+        update.set_price(prices_->GetPrice(key.vendor(), key.ingredient()));
+        OnPriceChange(update);
+      }
+
+    } else if (status_ == STREAM) {
+      // A write completed.
+      writing_ = false;
+      if (!ok || done_) {
+        // The client is gone.
+        Close();
+        return;
+      }
+      Flush();
+
+    } else {
+      GPR_ASSERT(status_ == FINISH);
+      finished_ = true;
+      MaybeDelete();
+    }
+}
+
+void ServerImpl::WatchCallData::OnPriceChange(const PriceUpdate& update) {
+    if (status_ != STREAM) return;
+
+    // Only the latest price per key matters to the subscriber.
+    pending_[absl::StrCat(update.vendor(), "/", update.ingredient())] = update;
+    Flush();
+}
+
+void ServerImpl::WatchCallData::Flush() {
+    if (writing_ || pending_.empty()) return;
+
+    batch_.Clear();
+    for (auto& entry : pending_) {
+      batch_.add_updates()->Swap(&entry.second);
+    }
+    pending_.clear();
+
+    writing_ = true;
+    writer_.Write(batch_, static_cast<Tag*>(this));
+}
+
+void ServerImpl::WatchCallData::Close() {
+    for (const PriceRequest& key : request_.keys()) {
+      prices_->Unsubscribe(key.vendor(), key.ingredient(), this);
+    }
+    pending_.clear();
+
+    status_ = FINISH;
+    writer_.Finish(Status::OK, static_cast<Tag*>(this));
+}
+
+void ServerImpl::WatchCallData::OnDone() {
+    done_ = true;
+
+    // With a write in flight, its completion takes care of closing the stream.
+    if (status_ == STREAM && !writing_) {
+      Close();
+      return;
+    }
+    MaybeDelete();
+}
+
+void ServerImpl::WatchCallData::MaybeDelete() {
+    if (done_ && finished_) delete this;
+}
+
+
+ServerImpl::PriceTicker::PriceTicker(ServerCompletionQueue* cq, PriceBook* prices, absl::Duration period)
+          : stopped_(false), cq_(cq), prices_(prices), period_(period) {
+    Arm();
+}
+
+void ServerImpl::PriceTicker::Proceed(bool ok) {
+    std::lock_guard<std::mutex> lock(mu_);
+
+    // The alarm was cancelled.
+    if (!ok || stopped_) return;
+
+    // Pick a random (vendor, ingredient) pair and move its price by up to 10%
+    const auto& inventory = prices_->inventory();
+    auto vendor_it = inventory.begin();
+    std::advance(vendor_it, rand() % inventory.size());
+    if (!vendor_it->second.empty()) {
+      auto item_it = vendor_it->second.begin();
+      std::advance(item_it, rand() % vendor_it->second.size());
+
+      const double factor = 1.0 + ((rand() % 21) - 10) / 100.0;
+      const double price = static_cast<int>(item_it->second * factor * 100 + 0.5) / 100.0;
+
+      // Copy the key since SetPrice writes to the map it lives in
+      const std::string vendor = vendor_it->first;
+      const std::string ingredient = item_it->first;
+      prices_->SetPrice(vendor, ingredient, price);
+    }
+
+    Arm();
+}
+
+void ServerImpl::PriceTicker::Stop() {
+    std::lock_guard<std::mutex> lock(mu_);
+    stopped_ = true;
+    alarm_.Cancel();
+}
+
+void ServerImpl::PriceTicker::Arm() {
+    alarm_.Set(cq_, std::chrono::system_clock::now() + absl::ToChronoMilliseconds(period_), this);
+}
+
 
 void ServerImpl::HandleRpcs() {
-    // Spawn a new CallData instance to serve new clients.
-    new CallData(&service_, cq_.get());
+    // A shutdown which came first has shut down the queue: only drain it.
+    std::unique_lock<std::mutex> lock(shutdown_mu_);
+    if (!shutting_down_) {
+      // Spawn CallData instances to serve new clients.
+      for (int i = 0; i < kCallsPerMethod; i++) {
+        new CallData(&service_, cq_.get(), &prices_, &scheduler_);
+      }
+
+      // Spawn BasketCallData instances to serve basket queries.
+      for (int i = 0; i < kCallsPerMethod; i++) {
+        new BasketCallData(&service_, cq_.get(), &prices_, &scheduler_);
+      }
+
+      // Spawn a new WatchCallData instance to serve new subscribers.
+      new WatchCallData(&service_, cq_.get(), &prices_);
+    }
+    lock.unlock();
+
     void* tag;  // uniquely identifies a request.
     bool ok;
     while (true) {
-      // Block waiting to read the next event from the completion queue. The
-      // event is uniquely identified by its tag, which in this case is the
-      // memory address of a CallData instance.
-      GPR_ASSERT(cq_->Next(&tag, &ok));
-      GPR_ASSERT(ok);
-      static_cast<CallData*>(tag)->Proceed();
-    }
-}
+      // Wait for the next event from the completion queue. The event is
+      // uniquely identified by its tag, which in this case is the memory
+      // address of a Tag instance. Streaming operations report failures
+      // (e.g. a subscriber that went away) through "ok".
+      //
+      // While requests are queued, only take the events already there, so
+      // that every request which arrived is queued by priority before the
+      // scheduler picks the next one to serve.
+      if (scheduler_.Empty()) {
+        // Next() returns false once the queue is shut down and drained.
+        if (!cq_->Next(&tag, &ok)) break;
+      } else {
+        const grpc::CompletionQueue::NextStatus status =
+            cq_->AsyncNext(&tag, &ok, std::chrono::system_clock::now());
+        if (status == grpc::CompletionQueue::SHUTDOWN) break;
+        if (status == grpc::CompletionQueue::TIMEOUT) {
+          scheduler_.ServeNext();
+          continue;
+        }
+      }
 
+      events_.fetch_add(1, std::memory_order_relaxed);
+      static_cast<Tag*>(tag)->Proceed(ok);
+    }
 
-int main(int argc, char** argv) {
-  ServerImpl server;
-  server.Run();
+    // Only left over if the shutdown deadline cut the drain short
+    scheduler_.Clear();
+}
 
-  return 0;
-} 
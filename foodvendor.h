@@ -20,30 +20,158 @@
 #ifndef FOOD_VENDOR_H
 #define FOOD_VENDOR_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <grpc++/grpc++.h>
+#include <grpcpp/alarm.h>
 #include "foodsystem.grpc.pb.h"
 
 #include <grpcpp/opencensus.h>
 
+#include "alloc_tracker.h"
 #include "foodsystem.grpc.pb.h"
 #include "absl/strings/str_cat.h"
 #include "absl/time/clock.h"
+#include "absl/time/time.h"
 
 
+using grpc::Alarm;
 using grpc::Server;
 using grpc::ServerAsyncResponseWriter;
+using grpc::ServerAsyncWriter;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
 using grpc::ServerCompletionQueue;
 using grpc::Status;
+using foodsystem::BasketPlan;
+using foodsystem::BasketRequest;
 using foodsystem::FoodSystem;
 using foodsystem::PriceInfo;
 using foodsystem::PriceRequest;
+using foodsystem::PriceUpdate;
+using foodsystem::PriceUpdateBatch;
+using foodsystem::PriceWatchRequest;
+
+
+/*
+* Receives a notification for every price change on a watched key.
+*/
+class PriceListener {
+  public:
+    virtual ~PriceListener() {}
+
+    /*
+    * Called on the completion queue thread after the price of a watched key changed.
+    *
+    * @param update - The vendor, ingredient and new price
+    */
+    virtual void OnPriceChange(const PriceUpdate& update) = 0;
+};
+
+
+/*
+* The vendors' inventory and prices, shared by every request served on the
+* completion queue. Only ever touched from the completion queue thread, so
+* no locking is needed.
+*/
+class PriceBook {
+  public:
+    /*
+    * Builds the per-ingredient index over the inventory.
+    */
+    PriceBook();
+
+    /*
+    * Looks up the price of an ingredient at a vendor.
+    *
+    * @param vendor - The vendor to look up
+    * @param ingredient - The ingredient to look up
+    * @return price - The price, or 0 if the vendor does not sell the ingredient
+    */
+    double GetPrice(const std::string& vendor, const std::string& ingredient) const;
+
+    /*
+    * Updates the price of an ingredient at a vendor and notifies its watchers.
+    *
+    * @param vendor - The vendor whose price changed
+    * @param ingredient - The ingredient whose price changed
+    * @param price - The new price
+    */
+    void SetPrice(const std::string& vendor, const std::string& ingredient, double price);
+
+    /*
+    * Registers/unregisters a listener for a (vendor, ingredient) key.
+    */
+    void Subscribe(const std::string& vendor, const std::string& ingredient, PriceListener* listener);
+    void Unsubscribe(const std::string& vendor, const std::string& ingredient, PriceListener* listener);
+
+    /*
+    * Finds the cheapest vendor for every ingredient, and the cheapest single
+    * vendor selling all of them, in one pass over the per-ingredient index.
+    * Empty ingredient names are ignored.
+    *
+    * @param request - The ingredients in the basket
+    * @param plan - Filled with the cheapest items and single-vendor basket
+    * @return false - If the basket has no ingredients, leaving 'plan' empty
+    */
+    bool PlanBasket(const BasketRequest& request, BasketPlan* plan) const;
+
+    /*
+    * Read-only access to the whole inventory.
+    */
+    const std::unordered_map<std::string, std::map<std::string, double>>& inventory() const { return inventory_; }
+
+  private:
+    // A vendor's price for an ingredient, with the vendor stored by id.
+    struct Offer {
+      size_t vendor;
+      double price;
+    };
+
+    static std::string Key(const std::string& vendor, const std::string& ingredient);
+
+    /*
+    * Returns the id of a vendor, assigning a new one if needed.
+    */
+    size_t VendorId(const std::string& vendor);
+
+    // Statically stored database of suppliers and their respective inventory and price 
+    std::unordered_map<std::string, std::map<std::string, double>> inventory_ = {
+                                                                                {"Amazon", {{"onion", 2.39}, {"tomato", 1.99},
+                                                                                            {"cheese", 0.89}, {"eggs", 1.5}, {"mango", 4.5}}},
+                                                                                {"Walmart", {{"onion", 2.99}, {"eggs", 1.39},
+                                                                                             {"milk", 11}, {"orange", 2.8}}},
+                                                                                {"Costco", {{"eggs", 0.99}, {"potato", 4.99}, {"cheese", 1.1},
+                                                                                            {"tomato", 2.3}, {"avocado", 3.4}}},
+                                                                                {"Bazaar", {{"onion", 2.4}, {"milk", 9}, {"potato", 4.2},
+                                                                                              {"orange", 1.99}}},
+                                                                                {"Safeway", {{"orange", 1.5}, {"cheese", 0.5}, 
+                                                                                             {"avocado", 4.1}}}
+                                                                                };
+
+    // Vendor names by id, and ids by name
+    std::vector<std::string> vendor_names_;
+    std::unordered_map<std::string, size_t> vendor_ids_;
+
+    // Every vendor's offer for each ingredient
+    std::unordered_map<std::string, std::vector<Offer>> offers_;
+
+    // Listeners for each "vendor/ingredient" key
+    std::unordered_map<std::string, std::unordered_set<PriceListener*>> listeners_;
+};
+
 
 class ServerImpl final {
  public:
@@ -53,13 +181,129 @@ class ServerImpl final {
   ~ServerImpl();
 
   /*
-  * Runs the gRPC asynchronous server
+  * Builds and starts the server without serving requests yet.
+  *
+  * @param server_address : Address to listen on, or empty to only serve in-process channels
+  */
+  void Start(const std::string& server_address);
+
+  /*
+  * Creates a channel to the started server which skips the network stack.
+  */
+  std::shared_ptr<grpc::Channel> InProcessChannel();
+
+  /*
+  * Handles all the incoming RPCs, until the server is shut down and every
+  * pending operation has been drained.
   */
-  void Run();
+  void HandleRpcs();
+
+  /*
+  * Stops accepting RPCs, lets the ones in flight finish, then shuts down
+  * the completion queue so that HandleRpcs() returns. Call after Start(),
+  * from another thread than HandleRpcs().
+  *
+  * @param grace : How long in-flight RPCs get before they are cancelled
+  */
+  void Shutdown(absl::Duration grace);
 
  private:
+  // Base class for everything placed on the completion queue as a tag.
+  class Tag {
+    public:
+      Tag() : Tag(true) {}
+      virtual ~Tag() { if (counted_) outstanding--; }
+
+      // Number of calls and alarms alive, i.e. roughly the operations pending
+      // on the completion queue. A call with several tags counts once.
+      static std::atomic<int64_t> outstanding;
+
+      /*
+      * Handles a completion queue event for this tag.
+      *
+      * @param ok : Whether the operation associated with the event succeeded
+      */
+      virtual void Proceed(bool ok) = 0;
+
+    protected:
+      // Extra tags of a call which is already counted pass false.
+      explicit Tag(bool counted) : counted_(counted) { if (counted_) outstanding++; }
+
+    private:
+      const bool counted_;
+  };
+
+  // Request priority classes, from the "x-priority" request metadata.
+  enum Priority { INTERACTIVE = 0, BULK = 1, NUM_PRIORITIES = 2 };
+
+  // A matched request waiting for its turn on the completion queue thread.
+  class Job {
+    public:
+      virtual ~Job() {}
+
+      /*
+      * Does the work of the request and starts sending the reply.
+      */
+      virtual void Serve() = 0;
+  };
+
+  // Queues matched requests by priority class and picks the next one to
+  // serve by weighted round robin: while both classes have requests waiting,
+  // one bulk request is served for every kWeights[INTERACTIVE] interactive
+  // ones. Only used from the completion queue thread.
+  class Scheduler {
+    public:
+      Scheduler();
+
+      /*
+      * Reads the priority class of a request, i.e. BULK for "x-priority: bulk".
+      */
+      static Priority Classify(const ServerContext& ctx);
+
+      /*
+      * Queues a matched request.
+      *
+      * @param job : The request
+      * @param priority : Its priority class
+      * @param method : Its method, for metrics
+      */
+      void Push(Job* job, Priority priority, const char* method);
+
+      bool Empty() const;
+
+      /*
+      * Serves the next request, recording how long it waited and took.
+      */
+      void ServeNext();
+
+      /*
+      * Drops the requests still queued once the completion queue is shut down.
+      */
+      void Clear();
+
+    private:
+      struct Entry {
+        Job* job;
+        const char* method;
+        absl::Time enqueued;
+      };
+
+      /*
+      * Records the queue depth of a class.
+      */
+      void RecordDepth(Priority priority) const;
+
+      // Requests served from each class per round.
+      static const int kWeights[NUM_PRIORITIES];
+
+      std::deque<Entry> queues_[NUM_PRIORITIES];
+
+      // Requests each class may still be served in the current round.
+      int credits_[NUM_PRIORITIES];
+  };
+
   // Class encompasing the state and logic needed to serve a request.
-  class CallData {
+  class CallData final : public Tag, public Job {
     public:
       /* 
       * Take in the "service" instance (in this case representing an asynchronous
@@ -68,28 +312,27 @@ class ServerImpl final {
       * 
       * @param service : The means of communication with the gRPC at runtime for an asnychronous server
       * @param cq : The produce-consumer queue for asnychronous notifications
+      * @param prices : The shared inventory and prices
+      * @param scheduler : Where matched requests wait to be served
       */ 
-      CallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq);
+      CallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq, PriceBook* prices,
+               Scheduler* scheduler);
 
       /*
       * Handles all server logic. Tracks and acts upon the current state of an instance.
       */ 
-      void Proceed();
+      void Proceed(bool ok) override;
+
+      /*
+      * Looks up the price and finishes the request, once scheduled.
+      */
+      void Serve() override;
 
     private:
-      // Statically stored database of suppliers and their respective inventory and price 
-      std::unordered_map<std::string, std::map<std::string, double>> inventory = {
-                                                                                  {"Amazon", {{"onion", 2.39}, {"tomato", 1.99},
-                                                                                              {"cheese", 0.89}, {"eggs", 1.5}, {"mango", 4.5}}},
-                                                                                  {"Walmart", {{"onion", 2.99}, {"eggs", 1.39},
-                                                                                               {"milk", 11}, {"orange", 2.8}}},
-                                                                                  {"Costco", {{"eggs", 0.99}, {"potato", 4.99}, {"cheese", 1.1},
-                                                                                              {"tomato", 2.3}, {"avocado", 3.4}}},
-                                                                                  {"Bazaar", {{"onion", 2.4}, {"milk", 9}, {"potato", 4.2},
-                                                                                                {"orange", 1.99}}},
-                                                                                  {"Safeway", {{"orange", 1.5}, {"cheese", 0.5}, 
-                                                                                               {"avocado", 4.1}}}
-                                                                                  };
+      // The shared inventory and prices
+      PriceBook* prices_;
+
+      Scheduler* scheduler_;
 
       // The means of communication with the gRPC runtime for an asynchronous
       // server.
@@ -120,14 +363,188 @@ class ServerImpl final {
       CallStatus status_;  
   };
 
-  /*
-  * Handles all the incoming RPCs.
-  */
-  void HandleRpcs();
- 
+  // Serves one PlanBasket request. Same life cycle as CallData.
+  class BasketCallData final : public Tag, public Job {
+    public:
+      /*
+      * @param service : The means of communication with the gRPC at runtime for an asnychronous server
+      * @param cq : The produce-consumer queue for asnychronous notifications
+      * @param prices : The shared inventory and prices
+      * @param scheduler : Where matched requests wait to be served
+      */
+      BasketCallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq, PriceBook* prices,
+                     Scheduler* scheduler);
+
+      /*
+      * Handles all server logic. Tracks and acts upon the current state of an instance.
+      */
+      void Proceed(bool ok) override;
+
+      /*
+      * Plans the basket and finishes the request, once scheduled.
+      */
+      void Serve() override;
+
+    private:
+      PriceBook* prices_;
+      Scheduler* scheduler_;
+      FoodSystem::AsyncService* service_;
+      ServerCompletionQueue* cq_;
+      ServerContext ctx_;
+      BasketRequest request_;
+      BasketPlan reply_;
+      ServerAsyncResponseWriter<BasketPlan> responder_;
+
+      enum CallStatus { CREATE, PROCESS, FINISH };
+      CallStatus status_;
+  };
+
+  // Serves one WatchPrices stream. Price changes are coalesced per key while a
+  // write is in flight and sent as a single batch once it completes, so a slow
+  // subscriber only ever costs one pending batch and no thread.
+  class WatchCallData final : public Tag, public PriceListener {
+    public:
+      /*
+      * @param service : The means of communication with the gRPC at runtime for an asnychronous server
+      * @param cq : The produce-consumer queue for asnychronous notifications
+      * @param prices : The shared inventory and prices
+      */
+      WatchCallData(FoodSystem::AsyncService* service, ServerCompletionQueue* cq, PriceBook* prices);
+
+      /*
+      * Handles all server logic. Tracks and acts upon the current state of an instance.
+      */
+      void Proceed(bool ok) override;
+
+      /*
+      * Queues the update for the next batch sent to this subscriber.
+      */
+      void OnPriceChange(const PriceUpdate& update) override;
+
+    private:
+      // Delivered by the runtime once the stream is over (including client cancellation).
+      class DoneTag final : public Tag {
+        public:
+          explicit DoneTag(WatchCallData* owner) : Tag(false), owner_(owner) {}
+          void Proceed(bool) override { owner_->OnDone(); }
+        private:
+          WatchCallData* owner_;
+      };
+
+      /*
+      * Starts writing the pending updates unless a write is already in flight.
+      */
+      void Flush();
+
+      /*
+      * Unsubscribes from all keys and finishes the stream.
+      */
+      void Close();
+
+      /*
+      * Handles the end of the stream as reported by the runtime.
+      */
+      void OnDone();
+
+      /*
+      * Deallocates this instance once both the stream finished and the done tag arrived.
+      */
+      void MaybeDelete();
+
+      // The shared inventory and prices
+      PriceBook* prices_;
+
+      FoodSystem::AsyncService* service_;
+      ServerCompletionQueue* cq_;
+      ServerContext ctx_;
+
+      // The keys the client subscribed to.
+      PriceWatchRequest request_;
+
+      // The means to stream batches back to the client.
+      ServerAsyncWriter<PriceUpdateBatch> writer_;
+
+      DoneTag done_tag_;
+
+      // Latest update per "vendor/ingredient" key not sent yet.
+      std::map<std::string, PriceUpdate> pending_;
+
+      // The batch currently being written. Must outlive the write.
+      PriceUpdateBatch batch_;
+
+      // Whether a write is in flight.
+      bool writing_;
+
+      // Whether the done tag has been delivered.
+      bool done_;
+
+      // Whether the Finish operation has completed.
+      bool finished_;
+
+      enum CallStatus { CREATE, PROCESS, STREAM, FINISH };
+      CallStatus status_;
+  };
+
+  // Simulates a price feed by periodically nudging a random price, which
+  // exercises the WatchPrices fan-out. Driven by an alarm on the completion
+  // queue so that all price book access stays on one thread.
+  class PriceTicker final : public Tag {
+    public:
+      /*
+      * @param cq : The produce-consumer queue for asnychronous notifications
+      * @param prices : The shared inventory and prices
+      * @param period : Time between two price changes
+      */
+      PriceTicker(ServerCompletionQueue* cq, PriceBook* prices, absl::Duration period);
+
+      /*
+      * Changes one price and re-arms the alarm.
+      */
+      void Proceed(bool ok) override;
+
+      /*
+      * Cancels the alarm for good, so that the completion queue can shut down.
+      * Thread safe.
+      */
+      void Stop();
+
+    private:
+      void Arm();
+
+      // Guards against re-arming the alarm while being stopped.
+      std::mutex mu_;
+      bool stopped_;
+
+      ServerCompletionQueue* cq_;
+      PriceBook* prices_;
+      absl::Duration period_;
+      Alarm alarm_;
+  };
+
+  // Unary requests posted per method, so that a burst of requests is matched
+  // and queued by priority right away rather than one at a time.
+  static const int kCallsPerMethod = 16;
+
   std::unique_ptr<ServerCompletionQueue> cq_;
   FoodSystem::AsyncService service_;
   std::unique_ptr<Server> server_;
+
+  // Inventory and prices shared by all CallData instances.
+  PriceBook prices_;
+
+  // Matched unary requests waiting to be served.
+  Scheduler scheduler_;
+
+  // Source of simulated price changes.
+  std::unique_ptr<PriceTicker> ticker_;
+
+  // Set once Shutdown() starts, after which HandleRpcs() must not post
+  // requests to the completion queue any more.
+  std::mutex shutdown_mu_;
+  bool shutting_down_ = false;
+
+  // Completion queue events handled so far, by every server in the process.
+  static std::atomic<int64_t> events_;
 };
 
     
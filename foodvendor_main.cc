@@ -0,0 +1,48 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <thread>
+
+#include "exporters.h"
+#include "foodvendor.h"
+#include "supervisor.h"
+
+int main(int argc, char** argv) {
+  return RunWorkers([] {
+    BlockShutdownSignals();
+
+    // Register the OpenCensus gRPC plugin to enable stats and tracing in gRPC.
+    grpc::RegisterOpenCensusPlugin();
+
+    // Also starts the diagnostics server
+    RegisterExporters();
+
+    ServerImpl server;
+    server.Start("0.0.0.0:9002");
+
+    // Drain on SIGTERM, for rolling restarts. Only once the server is
+    // started, which Shutdown() needs.
+    std::thread drain([&server] {
+      WaitForShutdownSignal();
+      server.Shutdown(ShutdownGracePeriod());
+    });
+
+    server.HandleRpcs();
+    drain.join();
+  });
+}
@@ -0,0 +1,269 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "output_sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "absl/strings/str_cat.h"
+
+
+/* ############################################################################ */
+/* ############################ HELPER FUNCTIONS ############################## */
+/* ############################################################################ */
+
+namespace {
+
+/*
+* Encodes a string as a quoted JSON string.
+*/
+std::string JsonString(absl::string_view value) {
+    std::string out = "\"";
+    for (char c : value) {
+      switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+          } else {
+            out += c;
+          }
+      }
+    }
+    out += "\"";
+    return out;
+}
+
+}  // namespace
+
+
+/* ############################################################################ */
+/* ####################### FUNCTION IMPLEMENTATIONS ########################### */
+/* ############################################################################ */
+
+
+OutputSink::Field::Field(absl::string_view key, absl::string_view value)
+    : key(key), json_value(JsonString(value)) {}
+
+OutputSink::Field::Field(absl::string_view key, const char* value)
+    : Field(key, absl::string_view(value)) {}
+
+OutputSink::Field::Field(absl::string_view key, const std::string& value)
+    : Field(key, absl::string_view(value)) {}
+
+OutputSink::Field::Field(absl::string_view key, double value)
+    : key(key), json_value(std::isfinite(value) ? absl::StrCat(value) : "null") {}
+
+OutputSink::Field::Field(absl::string_view key, int64_t value)
+    : key(key), json_value(absl::StrCat(value)) {}
+
+OutputSink::Field::Field(absl::string_view key, int value)
+    : key(key), json_value(absl::StrCat(value)) {}
+
+
+OutputSink& OutputSink::Get() {
+    static OutputSink* sink = [] {
+      Format format = Format::kText;
+      const char* format_env = getenv("FOODFINDER_OUTPUT_FORMAT");
+      if (format_env != nullptr && strcmp(format_env, "json") == 0) {
+        format = Format::kJsonLines;
+      }
+
+      int fd = STDOUT_FILENO;
+      const char* file_env = getenv("FOODFINDER_OUTPUT_FILE");
+      if (file_env != nullptr) {
+        fd = open(file_env, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+          std::cerr << "Could not open " << file_env << ": " << strerror(errno)
+                    << ", writing to stdout instead.\n";
+          fd = STDOUT_FILENO;
+        }
+      }
+
+      // Write out whatever is still queued when the process exits
+      atexit([] { OutputSink::Get().Flush(); });
+
+      return new OutputSink(format, fd);
+    }();
+    return *sink;
+}
+
+OutputSink::OutputSink(Format format, int fd)
+    : format_(format), fd_(fd), head_(&stub_), tail_(&stub_),
+      pushed_(0), written_(0), sleeping_(false), stop_(false) {
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+    writer_ = std::thread(&OutputSink::WriterLoop, this);
+}
+
+OutputSink::~OutputSink() {
+    stop_.store(true);
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+    }
+    wake_.notify_one();
+    writer_.join();
+
+    if (fd_ != STDOUT_FILENO) close(fd_);
+}
+
+void OutputSink::Text(absl::string_view line) {
+    if (format_ == Format::kJsonLines) return;
+    Push(absl::StrCat(line, "\n"));
+}
+
+void OutputSink::Record(absl::string_view type, std::initializer_list<Field> fields, absl::string_view text) {
+    if (format_ == Format::kText) {
+      Push(absl::StrCat(text, "\n"));
+      return;
+    }
+
+    std::string line = absl::StrCat("{\"type\":", JsonString(type));
+    for (const Field& field : fields) {
+      absl::StrAppend(&line, ",", JsonString(field.key), ":", field.json_value);
+    }
+    line += "}\n";
+    Push(std::move(line));
+}
+
+void OutputSink::Error(absl::string_view message) {
+    Record("error", {{"message", message}}, message);
+}
+
+void OutputSink::Flush() {
+    const uint64_t target = pushed_.load();
+
+    std::unique_lock<std::mutex> lock(mu_);
+    wake_.notify_one();
+    drained_.wait(lock, [this, target] { return written_.load() >= target; });
+}
+
+void OutputSink::Push(std::string line) {
+    Node* node = new Node;
+    node->next.store(nullptr, std::memory_order_relaxed);
+    node->line = std::move(line);
+
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+
+    pushed_.fetch_add(1);
+    if (sleeping_.load()) wake_.notify_one();
+}
+
+OutputSink::Node* OutputSink::Pop() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+
+    // Skip over the stub node
+    if (tail == &stub_) {
+      if (next == nullptr) return nullptr;
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+
+    // A producer is half way through pushing after 'tail'
+    if (tail != head_.load(std::memory_order_acquire)) return nullptr;
+
+    // 'tail' is the last node: put the stub back behind it so it can be popped
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(&stub_, std::memory_order_acq_rel);
+    prev->next.store(&stub_, std::memory_order_release);
+
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+}
+
+void OutputSink::WriterLoop() {
+    while (true) {
+      const uint64_t lines = Drain();
+      if (lines > 0) {
+        written_.fetch_add(lines);
+        {
+          std::lock_guard<std::mutex> lock(mu_);
+        }
+        drained_.notify_all();
+        continue;
+      }
+
+      if (stop_.load() && pushed_.load() == written_.load()) break;
+
+      // Nothing to write: sleep until a producer wakes us up. The timeout
+      // bounds the delay should a wake-up race with going to sleep.
+      std::unique_lock<std::mutex> lock(mu_);
+      sleeping_.store(true);
+      wake_.wait_for(lock, std::chrono::milliseconds(10), [this] {
+        return stop_.load() || pushed_.load() != written_.load();
+      });
+      sleeping_.store(false);
+    }
+}
+
+uint64_t OutputSink::Drain() {
+    std::string buffer;
+    uint64_t lines = 0;
+
+    Node* node;
+    while ((node = Pop()) != nullptr) {
+      buffer += node->line;
+      delete node;
+      lines++;
+
+      if (buffer.size() >= kMaxBatchBytes) {
+        WriteAll(buffer);
+        buffer.clear();
+      }
+    }
+
+    if (!buffer.empty()) WriteAll(buffer);
+    return lines;
+}
+
+void OutputSink::WriteAll(const std::string& buffer) {
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+      const ssize_t n = write(fd_, buffer.data() + offset, buffer.size() - offset);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return;
+      }
+      offset += n;
+    }
+}
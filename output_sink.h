@@ -0,0 +1,164 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "absl/strings/string_view.h"
+
+
+/*
+* Asynchronous, batched output for results and status lines.
+*
+* Callers format their line and push it onto a lock-free queue; a writer
+* thread drains the queue and writes whole batches with a single write(2),
+* so the calling thread never waits on the terminal or the disk.
+*
+* The format and destination are picked from the environment:
+*   FOODFINDER_OUTPUT_FORMAT=json  - one JSON object per line instead of text
+*   FOODFINDER_OUTPUT_FILE=<path>  - append to a file instead of stdout
+*/
+class OutputSink {
+  public:
+    enum class Format { kText, kJsonLines };
+
+    // A field of a structured record, with its value already JSON encoded.
+    struct Field {
+      Field(absl::string_view key, absl::string_view value);
+      Field(absl::string_view key, const char* value);
+      Field(absl::string_view key, const std::string& value);
+      Field(absl::string_view key, double value);
+      Field(absl::string_view key, int64_t value);
+      Field(absl::string_view key, int value);
+
+      absl::string_view key;
+      std::string json_value;
+    };
+
+    /*
+    * @return sink - The process-wide sink, created on first use
+    */
+    static OutputSink& Get();
+
+    /*
+    * @param format - How records are rendered
+    * @param fd - File descriptor the writer thread writes to
+    */
+    OutputSink(Format format, int fd);
+
+    /*
+    * Writes everything still queued and stops the writer thread.
+    */
+    ~OutputSink();
+
+    /*
+    * Queues human-only output (headers, separators, prompts). Dropped in
+    * JSON mode.
+    */
+    void Text(absl::string_view line);
+
+    /*
+    * Queues a structured record.
+    *
+    * @param type - Kind of record, e.g. "price"
+    * @param fields - The record's fields, used for JSON output
+    * @param text - The line printed in text mode
+    */
+    void Record(absl::string_view type, std::initializer_list<Field> fields, absl::string_view text);
+
+    /*
+    * Queues an error message.
+    */
+    void Error(absl::string_view message);
+
+    /*
+    * Blocks until everything queued so far has been written. Only meant for
+    * the interactive loop, e.g. before prompting for input.
+    */
+    void Flush();
+
+    Format format() const { return format_; }
+
+  private:
+    // Node of the intrusive multi-producer single-consumer queue.
+    struct Node {
+      std::atomic<Node*> next;
+      std::string line;
+    };
+
+    // Maximum bytes gathered into a single write.
+    static const size_t kMaxBatchBytes = 64 * 1024;
+
+    /*
+    * Pushes a line ending in a newline. Lock-free, callable from any thread.
+    */
+    void Push(std::string line);
+
+    /*
+    * Pops the oldest line. Only called from the writer thread.
+    *
+    * @return node - The popped node, owned by the caller, or nullptr if empty
+    */
+    Node* Pop();
+
+    /*
+    * Writer thread main loop.
+    */
+    void WriterLoop();
+
+    /*
+    * Writes out everything currently queued.
+    *
+    * @return lines - Number of lines written
+    */
+    uint64_t Drain();
+
+    void WriteAll(const std::string& buffer);
+
+    const Format format_;
+    const int fd_;
+
+    // Producers swap themselves in at 'head_'; the writer pops from 'tail_'.
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+
+    // Lines pushed and lines written, used by Flush()
+    std::atomic<uint64_t> pushed_;
+    std::atomic<uint64_t> written_;
+
+    // Wake-ups for the writer. Producers only notify while it sleeps.
+    std::mutex mu_;
+    std::condition_variable wake_;
+    std::condition_variable drained_;
+    std::atomic<bool> sleeping_;
+    std::atomic<bool> stop_;
+
+    std::thread writer_;
+};
+
+
+#endif
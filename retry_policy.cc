@@ -0,0 +1,283 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "retry_policy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
+
+#include "absl/strings/str_cat.h"
+#include "opencensus/stats/aggregation.h"
+#include "opencensus/stats/stats.h"
+#include "opencensus/stats/view_descriptor.h"
+#include "opencensus/tags/tag_key.h"
+
+
+/* ############################################################################ */
+/* ################################# METRICS ################################## */
+/* ############################################################################ */
+
+opencensus::tags::TagKey endpoint_key = opencensus::tags::TagKey::Register("Endpoint");
+
+/* ------------------------------ RETRIES METRIC ------------------------------ */
+ABSL_CONST_INIT const absl::string_view rpc_retries_measure_name = "rpc retries count";
+
+const opencensus::stats::MeasureInt64 rpc_retries_measure =
+     opencensus::stats::MeasureInt64::Register(rpc_retries_measure_name,
+                                                "Retries sent after a failed rpc",
+                                                "retries");
+
+const auto rpc_retries_view_descriptor = opencensus::stats::ViewDescriptor()
+    .set_name("food_finder/rpc_retries")
+    .set_measure(rpc_retries_measure_name)
+    .set_aggregation(opencensus::stats::Aggregation::Count())
+    .add_column(endpoint_key)
+    .set_description("Cumulative count of RPC retries");
+
+/* ------------------------ RETRY BUDGET EXHAUSTED METRIC --------------------- */
+ABSL_CONST_INIT const absl::string_view retry_budget_exhausted_measure_name = "retry budget exhausted count";
+
+const opencensus::stats::MeasureInt64 retry_budget_exhausted_measure =
+     opencensus::stats::MeasureInt64::Register(retry_budget_exhausted_measure_name,
+                                                "Retries skipped because the retry budget was empty",
+                                                "retries");
+
+const auto retry_budget_exhausted_view_descriptor = opencensus::stats::ViewDescriptor()
+    .set_name("food_finder/retry_budget_exhausted")
+    .set_measure(retry_budget_exhausted_measure_name)
+    .set_aggregation(opencensus::stats::Aggregation::Count())
+    .add_column(endpoint_key)
+    .set_description("Cumulative count of retries skipped by the retry budget");
+
+/* ------------------------- BREAKER REJECTIONS METRIC ------------------------ */
+ABSL_CONST_INIT const absl::string_view breaker_rejections_measure_name = "circuit breaker rejections count";
+
+const opencensus::stats::MeasureInt64 breaker_rejections_measure =
+     opencensus::stats::MeasureInt64::Register(breaker_rejections_measure_name,
+                                                "Rpcs not sent because the circuit breaker was open",
+                                                "rpcs");
+
+const auto breaker_rejections_view_descriptor = opencensus::stats::ViewDescriptor()
+    .set_name("food_finder/circuit_breaker_rejections")
+    .set_measure(breaker_rejections_measure_name)
+    .set_aggregation(opencensus::stats::Aggregation::Count())
+    .add_column(endpoint_key)
+    .set_description("Cumulative count of RPCs rejected by the circuit breaker");
+
+/* --------------------------- BREAKER STATE METRIC --------------------------- */
+ABSL_CONST_INIT const absl::string_view breaker_state_measure_name = "circuit breaker state";
+
+const opencensus::stats::MeasureInt64 breaker_state_measure =
+     opencensus::stats::MeasureInt64::Register(breaker_state_measure_name,
+                                                "Circuit breaker state (0 closed, 1 half open, 2 open)",
+                                                "state");
+
+const auto breaker_state_view_descriptor = opencensus::stats::ViewDescriptor()
+    .set_name("food_finder/circuit_breaker_state")
+    .set_measure(breaker_state_measure_name)
+    .set_aggregation(opencensus::stats::Aggregation::LastValue())
+    .add_column(endpoint_key)
+    .set_description("Current circuit breaker state per endpoint");
+
+
+void RegisterRetryPolicyViewsForExport() {
+    rpc_retries_view_descriptor.RegisterForExport();
+    retry_budget_exhausted_view_descriptor.RegisterForExport();
+    breaker_rejections_view_descriptor.RegisterForExport();
+    breaker_state_view_descriptor.RegisterForExport();
+}
+
+
+/* ############################################################################ */
+/* ####################### FUNCTION IMPLEMENTATIONS ########################### */
+/* ############################################################################ */
+
+
+RetryBudget::RetryBudget(double ratio, double max_tokens)
+    : ratio_(ratio), max_tokens_(max_tokens), tokens_(max_tokens) {}
+
+void RetryBudget::OnRequest() {
+    std::lock_guard<std::mutex> lock(mu_);
+    tokens_ = std::min(max_tokens_, tokens_ + ratio_);
+}
+
+bool RetryBudget::TryAcquire() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (tokens_ < 1) return false;
+    tokens_ -= 1;
+    return true;
+}
+
+
+CircuitBreaker::CircuitBreaker(const std::string& endpoint, int failure_threshold, absl::Duration open_duration)
+    : endpoint_(endpoint), failure_threshold_(failure_threshold), open_duration_(open_duration),
+      state_(CLOSED), generation_(0), consecutive_failures_(0), opened_at_(absl::InfinitePast()),
+      probe_in_flight_(false) {}
+
+bool CircuitBreaker::Allow(uint64_t* permit) {
+    std::lock_guard<std::mutex> lock(mu_);
+
+    if (state_ == OPEN && absl::Now() - opened_at_ >= open_duration_) {
+      Transition(HALF_OPEN);
+    }
+
+    if (state_ == CLOSED) {
+      *permit = generation_;
+      return true;
+    }
+
+    // Only one probe at a time while half open
+    if (state_ == HALF_OPEN && !probe_in_flight_) {
+      probe_in_flight_ = true;
+      *permit = generation_;
+      return true;
+    }
+
+    opencensus::stats::Record({{breaker_rejections_measure, 1}}, {{endpoint_key, endpoint_}});
+    return false;
+}
+
+void CircuitBreaker::OnResult(uint64_t permit, Outcome outcome) {
+    std::lock_guard<std::mutex> lock(mu_);
+
+    // Sent before the last transition: stale
+    if (permit != generation_) return;
+
+    if (state_ == HALF_OPEN) {
+      // This is the probe's result
+      probe_in_flight_ = false;
+      if (outcome == SUCCESS) {
+        consecutive_failures_ = 0;
+        Transition(CLOSED);
+      } else if (outcome == FAILURE) {
+        // A failed probe re-opens the breaker straight away
+        opened_at_ = absl::Now();
+        Transition(OPEN);
+      }
+      return;
+    }
+
+    if (outcome == SUCCESS) {
+      consecutive_failures_ = 0;
+    } else if (outcome == FAILURE && ++consecutive_failures_ >= failure_threshold_) {
+      opened_at_ = absl::Now();
+      Transition(OPEN);
+    }
+}
+
+bool CircuitBreaker::WouldAllow() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (state_ == OPEN) return absl::Now() - opened_at_ >= open_duration_;
+    return state_ == CLOSED || !probe_in_flight_;
+}
+
+CircuitBreaker::State CircuitBreaker::state() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return state_;
+}
+
+void CircuitBreaker::Transition(State state) {
+    state_ = state;
+    generation_++;
+    consecutive_failures_ = 0;
+    opencensus::stats::Record({{breaker_state_measure, static_cast<int64_t>(state)}}, {{endpoint_key, endpoint_}});
+}
+
+
+RetryPolicy::RetryPolicy(const std::string& endpoint, const RetryOptions& options)
+    : endpoint_(endpoint), options_(options),
+      budget_(options.budget_ratio, options.budget_max_tokens),
+      breaker_(endpoint, options.breaker_failure_threshold, options.breaker_open_duration) {}
+
+grpc::Status RetryPolicy::Call(const std::function<grpc::Status()>& attempt) {
+    RecordRequest();
+
+    for (int i = 0; ; i++) {
+      uint64_t permit;
+      if (!Allow(&permit)) return BreakerOpenStatus();
+
+      const grpc::Status status = attempt();
+      RecordResult(status, permit);
+
+      if (status.ok() || !ShouldRetry(status, i)) return status;
+
+      absl::SleepFor(Backoff(i));
+    }
+}
+
+void RetryPolicy::RecordRequest() {
+    budget_.OnRequest();
+}
+
+bool RetryPolicy::Allow(uint64_t* permit) {
+    return breaker_.Allow(permit);
+}
+
+void RetryPolicy::RecordResult(const grpc::Status& status, uint64_t permit) {
+    // Only transient failures say something about the endpoint's health
+    CircuitBreaker::Outcome outcome = CircuitBreaker::NEUTRAL;
+    if (status.ok()) {
+      outcome = CircuitBreaker::SUCCESS;
+    } else if (IsRetryable(status)) {
+      outcome = CircuitBreaker::FAILURE;
+    }
+    breaker_.OnResult(permit, outcome);
+}
+
+bool RetryPolicy::ShouldRetry(const grpc::Status& status, int attempt) {
+    if (!IsRetryable(status) || attempt + 1 >= options_.max_attempts) return false;
+
+    // Checked first, so that an outage doesn't drain the budget on retries never sent
+    if (!breaker_.WouldAllow()) {
+      opencensus::stats::Record({{breaker_rejections_measure, 1}}, {{endpoint_key, endpoint_}});
+      return false;
+    }
+
+    if (!budget_.TryAcquire()) {
+      opencensus::stats::Record({{retry_budget_exhausted_measure, 1}}, {{endpoint_key, endpoint_}});
+      return false;
+    }
+
+    opencensus::stats::Record({{rpc_retries_measure, 1}}, {{endpoint_key, endpoint_}});
+    return true;
+}
+
+absl::Duration RetryPolicy::Backoff(int attempt) const {
+    const absl::Duration backoff = std::min(options_.max_backoff,
+                                            options_.initial_backoff * std::pow(options_.backoff_multiplier, attempt));
+
+    // Full jitter spreads out the retries of requests which failed together
+    return backoff * (static_cast<double>(rand()) / RAND_MAX);
+}
+
+grpc::Status RetryPolicy::BreakerOpenStatus() const {
+    return grpc::Status(grpc::StatusCode::UNAVAILABLE, absl::StrCat("circuit breaker open for ", endpoint_));
+}
+
+bool RetryPolicy::IsRetryable(const grpc::Status& status) {
+    switch (status.error_code()) {
+      case grpc::StatusCode::CANCELLED:
+      case grpc::StatusCode::UNAVAILABLE:
+      case grpc::StatusCode::DEADLINE_EXCEEDED:
+      case grpc::StatusCode::RESOURCE_EXHAUSTED:
+        return true;
+      default:
+        return false;
+    }
+}
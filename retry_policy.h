@@ -0,0 +1,240 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include <grpc++/grpc++.h>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+
+/*
+* Tunables of a RetryPolicy.
+*/
+struct RetryOptions {
+  // Maximum number of attempts per request, including the first one
+  int max_attempts = 3;
+
+  // Backoff before the first retry, growing by 'backoff_multiplier' per retry
+  // up to 'max_backoff'. The actual sleep is drawn uniformly from [0, backoff].
+  absl::Duration initial_backoff = absl::Milliseconds(10);
+  double backoff_multiplier = 2.0;
+  absl::Duration max_backoff = absl::Milliseconds(200);
+
+  // Retry tokens earned per request, i.e. the long run cap on retries as a
+  // fraction of base traffic, and the most tokens that can be saved up.
+  double budget_ratio = 0.2;
+  double budget_max_tokens = 10;
+
+  // Consecutive failures which open the circuit breaker, and how long it
+  // stays open before letting a single probe through.
+  int breaker_failure_threshold = 5;
+  absl::Duration breaker_open_duration = absl::Seconds(1);
+};
+
+
+/*
+* Token bucket which caps retries to a fraction of the requests made.
+*/
+class RetryBudget {
+  public:
+    RetryBudget(double ratio, double max_tokens);
+
+    /*
+    * Credits the budget for one request.
+    */
+    void OnRequest();
+
+    /*
+    * Takes a token for one retry.
+    *
+    * @return true - If the retry is within budget
+    */
+    bool TryAcquire();
+
+  private:
+    std::mutex mu_;
+    const double ratio_;
+    const double max_tokens_;
+    double tokens_;
+};
+
+
+/*
+* Stops sending requests to an endpoint after consecutive failures, and lets
+* a single probe through once 'open_duration' has passed to decide whether
+* to close again.
+*
+* Every allowed request gets a permit naming the state it was let through
+* in. Results are only taken into account while the breaker is still in
+* that state, so a late response to a request sent before the breaker
+* opened cannot close it, and only the probe decides how HALF_OPEN ends.
+*/
+class CircuitBreaker {
+  public:
+    enum State { CLOSED = 0, HALF_OPEN = 1, OPEN = 2 };
+
+    // How a request went, as far as the endpoint's health is concerned
+    enum Outcome { SUCCESS, FAILURE, NEUTRAL };
+
+    /*
+    * @param endpoint - Name of the endpoint, used to tag the breaker state metric
+    * @param failure_threshold - Consecutive failures which open the breaker
+    * @param open_duration - Time spent open before a probe is allowed
+    */
+    CircuitBreaker(const std::string& endpoint, int failure_threshold, absl::Duration open_duration);
+
+    /*
+    * @param permit - Set to the permit of the request, if allowed
+    * @return true - If a request may be sent now
+    */
+    bool Allow(uint64_t* permit);
+
+    /*
+    * Reports the outcome of a request which was allowed.
+    *
+    * @param permit - The permit Allow() gave the request
+    * @param outcome - How the request went
+    */
+    void OnResult(uint64_t permit, Outcome outcome);
+
+    /*
+    * Like Allow(), without taking a permit or changing state.
+    *
+    * @return true - If a request sent now would be let through
+    */
+    bool WouldAllow();
+
+    State state();
+
+  private:
+    /*
+    * Changes state and exports it. Must be called with 'mu_' held.
+    */
+    void Transition(State state);
+
+    std::mutex mu_;
+    const std::string endpoint_;
+    const int failure_threshold_;
+    const absl::Duration open_duration_;
+    State state_;
+
+    // Bumped on every transition: permits from before it are stale
+    uint64_t generation_;
+
+    int consecutive_failures_;
+    absl::Time opened_at_;
+    bool probe_in_flight_;
+};
+
+
+/*
+* Retry policy for the RPCs sent to one endpoint: exponential backoff with
+* jitter, bounded by a retry budget and guarded by a circuit breaker.
+*
+* Synchronous callers use Call(). Asynchronous callers drive the attempts
+* themselves with RecordRequest(), Allow(), RecordResult(), ShouldRetry()
+* and Backoff().
+*/
+class RetryPolicy {
+  public:
+    /*
+    * @param endpoint - Name of the endpoint, used to tag the exported metrics
+    * @param options - Backoff, budget and breaker settings
+    */
+    RetryPolicy(const std::string& endpoint, const RetryOptions& options = RetryOptions());
+
+    /*
+    * Runs 'attempt' until it succeeds, fails with a status that is not worth
+    * retrying, or the policy gives up. Sleeps between attempts.
+    *
+    * @param attempt - Sends one RPC
+    * @return status - The status of the last attempt, or UNAVAILABLE if the breaker is open
+    */
+    grpc::Status Call(const std::function<grpc::Status()>& attempt);
+
+    /*
+    * Counts one request towards the base traffic the retry budget is based on.
+    */
+    void RecordRequest();
+
+    /*
+    * @param permit - Set to the attempt's circuit breaker permit, if allowed
+    * @return true - If the circuit breaker lets an attempt through
+    */
+    bool Allow(uint64_t* permit);
+
+    /*
+    * Reports the status of an attempt to the circuit breaker. Only OK counts
+    * as a success and only retryable codes as failures: other errors say
+    * nothing about the endpoint's health.
+    *
+    * @param status - The status of the attempt
+    * @param permit - The permit Allow() gave the attempt
+    */
+    void RecordResult(const grpc::Status& status, uint64_t permit);
+
+    /*
+    * Decides whether to retry after a failed attempt, taking a budget token if
+    * so. No token is taken if the circuit breaker would reject the retry.
+    *
+    * @param status - The status of the failed attempt
+    * @param attempt - The number of the failed attempt, starting at 0
+    */
+    bool ShouldRetry(const grpc::Status& status, int attempt);
+
+    /*
+    * @param attempt - The number of the failed attempt, starting at 0
+    * @return backoff - How long to wait before the next attempt
+    */
+    absl::Duration Backoff(int attempt) const;
+
+    /*
+    * The status reported for attempts rejected by the circuit breaker.
+    */
+    grpc::Status BreakerOpenStatus() const;
+
+    const std::string& endpoint() const { return endpoint_; }
+
+  private:
+    /*
+    * @return true - If the status signals a transient failure
+    */
+    static bool IsRetryable(const grpc::Status& status);
+
+    const std::string endpoint_;
+    const RetryOptions options_;
+    RetryBudget budget_;
+    CircuitBreaker breaker_;
+};
+
+
+/*
+* Registers the retry and circuit breaker views for export.
+*/
+void RegisterRetryPolicyViewsForExport();
+
+
+#endif
@@ -0,0 +1,2 @@
+#!/bin/bash
+env STACKDRIVER_PROJECT_ID=snehilc-playground ~/Desktop/OpenTelemetry-StarterProject/bazel-bin/foodsystem_all
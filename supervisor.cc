@@ -0,0 +1,180 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "supervisor.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+
+
+/* ############################################################################ */
+/* ############################ HELPER FUNCTIONS ############################## */
+/* ############################################################################ */
+
+namespace {
+
+// Workers which die sooner than this after starting are restarted with a delay,
+// so that a worker failing on startup does not turn into a fork loop.
+const absl::Duration kMinWorkerLifetime = absl::Seconds(1);
+
+/*
+* Builds the set of signals the supervisor and the workers wait for.
+*/
+sigset_t ShutdownSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    return signals;
+}
+
+/*
+* Forks worker 'index', which runs 'serve' and exits.
+*
+* @return pid - The worker's pid, or -1 if the fork failed
+*/
+pid_t StartWorker(int index, const std::function<void()>& serve) {
+    const pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // Give each worker its own diagnostics port, next to the configured one
+    const char* diagnostics_port = getenv("DIAGNOSTICS_PORT");
+    if (diagnostics_port != nullptr) {
+      setenv("DIAGNOSTICS_PORT", absl::StrCat(atoi(diagnostics_port) + index).c_str(), 1);
+    }
+
+    // Workers leave SIGCHLD to the default handling again
+    sigset_t child_signals;
+    sigemptyset(&child_signals);
+    sigaddset(&child_signals, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &child_signals, nullptr);
+
+    serve();
+    _exit(0);
+}
+
+}  // namespace
+
+
+/* ############################################################################ */
+/* ####################### FUNCTION IMPLEMENTATIONS ########################### */
+/* ############################################################################ */
+
+
+int RunWorkers(const std::function<void()>& serve) {
+    const char* workers_env = getenv("WORKERS");
+    const int worker_count = workers_env == nullptr ? 0 : atoi(workers_env);
+    if (worker_count <= 0) {
+      serve();
+      return 0;
+    }
+
+    // Shutdown signals and worker exits are all handled from the loop below
+    sigset_t signals = ShutdownSignals();
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+    // Running workers' index and start time, by pid
+    std::map<pid_t, std::pair<int, absl::Time>> workers;
+    for (int i = 0; i < worker_count; i++) {
+      const pid_t pid = StartWorker(i, serve);
+      if (pid < 0) {
+        std::cerr << "Cannot start worker " << i << ": " << strerror(errno) << "\n";
+        continue;
+      }
+      workers[pid] = {i, absl::Now()};
+    }
+    std::cout << "Supervising " << workers.size() << " workers" << std::endl;
+
+    bool stopping = false;
+    while (!workers.empty()) {
+      int signal;
+      if (sigwait(&signals, &signal) != 0) continue;
+
+      if (signal == SIGTERM || signal == SIGINT) {
+        if (stopping) continue;
+        stopping = true;
+
+        // Let every worker drain its in-flight RPCs
+        std::cout << "Stopping " << workers.size() << " workers" << std::endl;
+        for (const auto& worker : workers) kill(worker.first, SIGTERM);
+        continue;
+      }
+
+      // SIGCHLD: reap every worker that exited, restarting it unless stopping
+      int status;
+      pid_t pid;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto it = workers.find(pid);
+        if (it == workers.end()) continue;
+        const int index = it->second.first;
+        const absl::Duration lifetime = absl::Now() - it->second.second;
+        workers.erase(it);
+        if (stopping) continue;
+
+        std::cerr << "Worker " << index << " (pid " << pid << ") exited with status " << status
+                  << ", restarting it\n";
+        if (lifetime < kMinWorkerLifetime) absl::SleepFor(kMinWorkerLifetime);
+
+        const pid_t new_pid = StartWorker(index, serve);
+        if (new_pid < 0) {
+          std::cerr << "Cannot restart worker " << index << ": " << strerror(errno) << "\n";
+          continue;
+        }
+        workers[new_pid] = {index, absl::Now()};
+      }
+    }
+
+    return 0;
+}
+
+
+void ShareListeningPorts(grpc::ServerBuilder* builder) {
+    builder->AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, 1);
+}
+
+
+void BlockShutdownSignals() {
+    const sigset_t signals = ShutdownSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+
+void WaitForShutdownSignal() {
+    const sigset_t signals = ShutdownSignals();
+    int signal;
+    while (sigwait(&signals, &signal) != 0) {}
+}
+
+
+absl::Duration ShutdownGracePeriod() {
+    const char* grace_env = getenv("SHUTDOWN_GRACE_MS");
+    return grace_env == nullptr ? absl::Seconds(5) : absl::Milliseconds(atoi(grace_env));
+}
@@ -0,0 +1,75 @@
+/*
+ *
+ * Copyright 2015 gRPC authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <functional>
+
+#include <grpc++/grpc++.h>
+
+#include "absl/time/time.h"
+
+
+/*
+* Runs a server in worker processes when the WORKERS environment variable is
+* set to a count N, and in this process otherwise. Each worker binds the same
+* port, which gRPC opens with SO_REUSEPORT, so the kernel spreads incoming
+* connections across them.
+*
+* The supervisor restarts workers that die, and forwards SIGTERM/SIGINT to
+* all of them, then waits for them to drain and exit. Must be called before
+* any thread is started, since only the calling thread survives a fork.
+*
+* @param serve - Runs the server, returning once it is drained
+* @return exit_code - The process exit code
+*/
+int RunWorkers(const std::function<void()>& serve);
+
+
+/*
+* Lets the worker processes started by RunWorkers() listen on the same port.
+* This is gRPC's default on Linux, made explicit since the workers rely on it.
+*
+* @param builder - Builder of a server run by the workers
+*/
+void ShareListeningPorts(grpc::ServerBuilder* builder);
+
+
+/*
+* Blocks SIGTERM and SIGINT in the calling thread and in all threads it
+* starts from then on, so that they are only seen by WaitForShutdownSignal().
+* Must be called before any thread is started.
+*/
+void BlockShutdownSignals();
+
+
+/*
+* Waits for SIGTERM or SIGINT. Requires BlockShutdownSignals().
+*/
+void WaitForShutdownSignal();
+
+
+/*
+* @return grace - How long in-flight RPCs get to finish on shutdown before they
+*                 are cancelled: SHUTDOWN_GRACE_MS, or 5s by default
+*/
+absl::Duration ShutdownGracePeriod();
+
+
+#endif